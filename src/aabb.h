@@ -0,0 +1,60 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "ray.h"
+
+// axis-aligned bounding box, stored as its min and max corners
+class aabb {
+public:
+    point3 minimum;
+    point3 maximum;
+
+    // default box is empty (min > max) so it can be grown with surrounding_box
+    aabb() : minimum(infinity, infinity, infinity), maximum(-infinity, -infinity, -infinity) {}
+    aabb(const point3& a, const point3& b) : minimum(a), maximum(b) {}
+
+    point3 min() const { return minimum; }
+    point3 max() const { return maximum; }
+
+    point3 centroid() const { return 0.5 * (minimum + maximum); }
+
+    // slab test: intersect the ray with each pair of axis planes and shrink [t_min, t_max]
+    bool hit(const ray& r, double t_min, double t_max) const {
+        for (int a = 0; a < 3; a++) {
+            auto inv_d = 1.0 / r.direction()[a];
+            auto t0 = (minimum[a] - r.origin()[a]) * inv_d;
+            auto t1 = (maximum[a] - r.origin()[a]) * inv_d;
+            if (inv_d < 0.0) std::swap(t0, t1);
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max <= t_min) return false;
+        }
+        return true;
+    }
+
+    // used by the surface area heuristic, the chance a ray hits a box is proportional to its area
+    double surface_area() const {
+        auto d = maximum - minimum;
+        if (d.x() < 0 || d.y() < 0 || d.z() < 0) return 0;
+        return 2.0 * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+    }
+
+    int longest_axis() const {
+        auto d = maximum - minimum;
+        if (d.x() > d.y() && d.x() > d.z()) return 0;
+        return d.y() > d.z() ? 1 : 2;
+    }
+};
+
+// plain compares instead of fmin/fmax, which the compiler can't turn into single instructions
+inline aabb surrounding_box(const aabb& box0, const aabb& box1) {
+    point3 small(box0.minimum.e[0] < box1.minimum.e[0] ? box0.minimum.e[0] : box1.minimum.e[0],
+                 box0.minimum.e[1] < box1.minimum.e[1] ? box0.minimum.e[1] : box1.minimum.e[1],
+                 box0.minimum.e[2] < box1.minimum.e[2] ? box0.minimum.e[2] : box1.minimum.e[2]);
+    point3 big(box0.maximum.e[0] > box1.maximum.e[0] ? box0.maximum.e[0] : box1.maximum.e[0],
+               box0.maximum.e[1] > box1.maximum.e[1] ? box0.maximum.e[1] : box1.maximum.e[1],
+               box0.maximum.e[2] > box1.maximum.e[2] ? box0.maximum.e[2] : box1.maximum.e[2]);
+    return aabb(small, big);
+}
+
+#endif
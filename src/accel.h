@@ -0,0 +1,102 @@
+#ifndef ACCEL_H
+#define ACCEL_H
+
+#include "wide_bvh.h"
+#include "compressed_bvh.h"
+#include "binned_bvh.h"
+#include "lbvh.h"
+
+enum class bvh_kernel { scalar, sse_4wide, avx2_8wide };
+
+// widest traversal kernel this cpu supports
+inline bvh_kernel detect_bvh_kernel() {
+    if (cpu_has_avx2()) return bvh_kernel::avx2_8wide;
+    if (cpu_has_sse2()) return bvh_kernel::sse_4wide;
+    return bvh_kernel::scalar;
+}
+
+inline const char* bvh_kernel_name(bvh_kernel kernel) {
+    switch (kernel) {
+        case bvh_kernel::avx2_8wide: return "8-wide AVX2";
+        case bvh_kernel::sse_4wide: return "4-wide SSE";
+        default: return "scalar binary";
+    }
+}
+
+// how the 8-wide nodes are stored: full float boxes, or quantized child boxes that take 2.8x less
+// memory (80 byte nodes plus leaf references) and trace at about the same speed
+enum class bvh_node_format { full, compressed };
+
+inline const char* bvh_node_format_name(bvh_node_format format) {
+    return format == bvh_node_format::compressed ? "compressed (80 bytes)" : "full (256 bytes)";
+}
+
+// Order of the wide nodes in memory: depth-first as collapsed, or regrouped into treelets by
+// wide_bvh::reorder_treelets. Treelets only cut TLB misses, cache line misses stay the same,
+// and the pass adds about a tenth to the build, so it is off unless asked for.
+enum class bvh_node_layout { depth_first, treelets };
+
+inline const char* bvh_node_layout_name(bvh_node_layout layout) {
+    return layout == bvh_node_layout::treelets ? "treelets" : "depth-first";
+}
+
+// how the binary tree (which the wide kernels collapse) is built
+enum class bvh_builder {
+    sweep_sah,  // exact SAH over every object position, single threaded
+    binned_sah, // SAH over centroid bins, parallel on the thread pool
+    lbvh        // Morton code order, fastest to build, for scenes rebuilt every frame
+};
+
+inline const char* bvh_builder_name(bvh_builder builder) {
+    switch (builder) {
+        case bvh_builder::binned_sah: return "binned SAH";
+        case bvh_builder::lbvh: return "LBVH";
+        default: return "sweep SAH";
+    }
+}
+
+inline flat_bvh build_flat_bvh(const hittable_list& list, bvh_builder builder, threadPool* pool) {
+    flat_bvh binary;
+    switch (builder) {
+        case bvh_builder::binned_sah:
+            binned_bvh_builder(pool).build(list, binary);
+            break;
+        case bvh_builder::lbvh:
+            lbvh_builder(pool).build(list, binary);
+            break;
+        default:
+            binary = flat_bvh(list);
+            break;
+    }
+    return binary;
+}
+
+// the traversal structure for kernel, made from an already built binary tree. Compressed nodes
+// are only 8 wide and decode on any cpu, so they override the kernel. The layout applies to the
+// full wide nodes, the binary and compressed trees keep their own order.
+inline shared_ptr<accelerator> make_bvh(flat_bvh binary, bvh_kernel kernel, bvh_node_format format = bvh_node_format::full,
+                                        bvh_node_layout layout = bvh_node_layout::depth_first) {
+    if (format == bvh_node_format::compressed) return make_shared<compressed_bvh8>(bvh8(binary));
+    switch (kernel) {
+        case bvh_kernel::avx2_8wide: {
+            auto wide = make_shared<bvh8>(binary);
+            if (layout == bvh_node_layout::treelets) wide->reorder_treelets();
+            return wide;
+        }
+        case bvh_kernel::sse_4wide: {
+            auto wide = make_shared<bvh4>(binary);
+            if (layout == bvh_node_layout::treelets) wide->reorder_treelets();
+            return wide;
+        }
+        default: return make_shared<flat_bvh>(std::move(binary));
+    }
+}
+
+inline shared_ptr<accelerator> make_bvh(const hittable_list& list, bvh_kernel kernel,
+                                        bvh_builder builder = bvh_builder::binned_sah, threadPool* pool = nullptr,
+                                        bvh_node_format format = bvh_node_format::full,
+                                        bvh_node_layout layout = bvh_node_layout::depth_first) {
+    return make_bvh(build_flat_bvh(list, builder, pool), kernel, format, layout);
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef ALIGNED_H
+#define ALIGNED_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// std::allocator only guarantees alignof(max_align_t) before C++17, this one hands out
+// memory aligned to Align bytes so SIMD loads and cache-line sized nodes never straddle lines
+template <typename T, size_t Align = 64>
+class aligned_allocator {
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = aligned_allocator<U, Align>; };
+
+    aligned_allocator() = default;
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U, Align>&) {}
+
+    T* allocate(size_t n) {
+        void* p = nullptr;
+        if (posix_memalign(&p, Align, n * sizeof(T)) != 0) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t) { free(p); }
+};
+
+template <typename T, typename U, size_t Align>
+bool operator==(const aligned_allocator<T, Align>&, const aligned_allocator<U, Align>&) { return true; }
+
+template <typename T, typename U, size_t Align>
+bool operator!=(const aligned_allocator<T, Align>&, const aligned_allocator<U, Align>&) { return false; }
+
+#endif
@@ -0,0 +1,891 @@
+// Benchmarks for the hot paths of the renderer, built without SDL:
+//     make bench
+//     ./bench [section...]
+#include "common.h"
+#include "material.h"
+#include "accel.h"
+#include "bvh_cache.h"
+#include "primitive.h"
+#include "camera.h"
+#include "wavefront.h"
+#include "scenes.h"
+#include <chrono>
+#include <thread>
+
+using bench_clock = std::chrono::steady_clock;
+
+// correctness checks inside the sections count their failures here, ./bench exits with 1 if any failed
+int failed_checks = 0;
+
+double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+int bench_threads() {
+    int n = static_cast<int>(std::thread::hardware_concurrency());
+    return n > 0 ? n : 1;
+}
+
+// runs f(thread_index) on n threads at once, returns the best wall time of a few repetitions
+template <typename F>
+double run_threads(int n, F f, int repetitions = 5) {
+    double best = infinity;
+    for (int rep = 0; rep < repetitions; rep++) {
+        auto start = bench_clock::now();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < n; i++) threads.push_back(std::thread(f, i));
+        for (auto& t : threads) t.join();
+        best = fmin(best, seconds_since(start));
+    }
+    return best;
+}
+
+// n spheres of the given radius on a plane like random_scene(), sharing a handful of materials
+std::vector<shared_ptr<sphere>> sphere_field(int n, double extent, double radius = 0.2) {
+    std::vector<shared_ptr<material>> materials = {
+        make_shared<lambertian>(color(0.5, 0.5, 0.5)),
+        make_shared<lambertian>(color(0.4, 0.2, 0.1)),
+        make_shared<metal>(color(0.7, 0.6, 0.5), 0.0),
+        make_shared<dielectric>(1.5)
+    };
+    std::vector<shared_ptr<sphere>> spheres;
+    for (int i = 0; i < n; i++) {
+        point3 center(random_double(-extent, extent), radius, random_double(-extent, extent));
+        spheres.push_back(make_shared<sphere>(center, radius, materials[i % materials.size()]));
+    }
+    return spheres;
+}
+
+std::vector<ray> random_rays(int n, double extent) {
+    std::vector<ray> rays;
+    for (int i = 0; i < n; i++) {
+        // nearly horizontal through the layer of spheres so most rays pass many of them
+        point3 origin(random_double(-extent, extent), random_double(0.05, 0.15), random_double(-extent, extent));
+        rays.push_back(ray(origin, vec3(random_double(-1, 1), random_double(-0.02, 0.02), random_double(-1, 1))));
+    }
+    return rays;
+}
+
+// ---------------------------------------------------------------------------------------------
+// hit_record material pointer: shared_ptr (old) vs borrowed raw pointer (current)
+
+// hit_record as it was when it owned a shared_ptr to the material
+struct shared_material_record {
+    point3 p;
+    vec3 normal;
+    double t;
+    bool front_face;
+    shared_ptr<material> mat_ptr;
+};
+
+// what the old sphere::hit / hittable_list::hit pair did: assign the shared_ptr into a temporary
+// on every sphere hit and copy the whole temporary into rec on every closer hit
+bool closest_hit_shared(const std::vector<shared_ptr<sphere>>& spheres, const ray& r, shared_material_record& rec) {
+    shared_material_record temp;
+    hit_record geometry;
+    bool hit_anything = false;
+    auto closest_so_far = infinity;
+    for (const auto& s : spheres) {
+        if (s->hit(r, 0.001, closest_so_far, geometry)) {
+            temp.p = geometry.p;
+            temp.normal = geometry.normal;
+            temp.t = geometry.t;
+            temp.front_face = geometry.front_face;
+            temp.mat_ptr = s->mat;
+            hit_anything = true;
+            closest_so_far = temp.t;
+            rec = temp;
+        }
+    }
+    return hit_anything;
+}
+
+bool closest_hit_raw(const std::vector<shared_ptr<sphere>>& spheres, const ray& r, hit_record& rec) {
+    hit_record temp;
+    bool hit_anything = false;
+    auto closest_so_far = infinity;
+    for (const auto& s : spheres) {
+        if (s->hit(r, 0.001, closest_so_far, temp)) {
+            hit_anything = true;
+            closest_so_far = temp.t;
+            rec = temp;
+        }
+    }
+    return hit_anything;
+}
+
+// The bookkeeping alone: replays the material of every sphere hit of a closest-hit scan, in scan
+// order, through the old record (shared_ptr assignment plus record copy) or the current one. All
+// spheres share four materials, so threads running this at once update the same four reference
+// counts, which is the traffic the old record caused in the renderer.
+template <typename Record, typename Assign>
+double replay_hits(const std::vector<const shared_ptr<material>*>& sequence, int threads, Assign assign) {
+    std::vector<double> sink(threads);
+    return run_threads(threads, [&](int thread) {
+        Record temp, rec;
+        double t = 0;
+        rec.t = 0;
+        for (const shared_ptr<material>* mat : sequence) {
+            assign(temp, *mat);
+            temp.t = t += 1;
+            rec = temp;
+        }
+        sink[thread] = rec.t;
+    });
+}
+
+void bench_material_pointer() {
+    std::cout << "== hit_record material: shared_ptr vs raw pointer ==" << std::endl;
+    // few big spheres, so the hit bookkeeping is a large part of the work rather than the misses
+    const double extent = 4;
+    auto spheres = sphere_field(64, extent, 0.5);
+    auto rays = random_rays(200000, extent);
+
+    // every sphere hit used to cost a shared_ptr assignment and a record copy
+    std::vector<const shared_ptr<material>*> sequence;
+    for (const auto& r : rays) {
+        hit_record temp;
+        auto closest_so_far = infinity;
+        for (const auto& s : spheres) {
+            if (s->hit(r, 0.001, closest_so_far, temp)) {
+                closest_so_far = temp.t;
+                sequence.push_back(&s->mat);
+            }
+        }
+    }
+    long hits = static_cast<long>(sequence.size());
+
+    // With more threads than cores the threads take turns and never touch a count at the same
+    // time, so the cost per hit is normalized to the cores actually running them.
+    std::vector<int> thread_counts = {1, 4};
+    if (bench_threads() > 4) thread_counts.push_back(bench_threads());
+    for (int threads : thread_counts) {
+        int cores = std::min(threads, bench_threads());
+        double shared_time = replay_hits<shared_material_record>(sequence, threads,
+            [](shared_material_record& rec, const shared_ptr<material>& mat) { rec.mat_ptr = mat; });
+        double raw_time = replay_hits<hit_record>(sequence, threads,
+            [](hit_record& rec, const shared_ptr<material>& mat) { rec.mat_ptr = mat.get(); });
+        double scale = 1e9 * cores / (double(hits) * threads);
+        std::cout << threads << " thread(s) on " << cores << " core(s), record bookkeeping: shared_ptr "
+                  << shared_time * scale << "ns, raw " << raw_time * scale << "ns per hit, saving "
+                  << (shared_time - raw_time) * scale << "ns" << std::endl;
+    }
+
+    // the same in context, with the sphere tests around it
+    for (int threads : thread_counts) {
+        int cores = std::min(threads, bench_threads());
+        double shared_time = run_threads(threads, [&](int) {
+            shared_material_record rec;
+            for (const auto& r : rays) closest_hit_shared(spheres, r, rec);
+        });
+        double raw_time = run_threads(threads, [&](int) {
+            hit_record rec;
+            for (const auto& r : rays) closest_hit_raw(spheres, r, rec);
+        });
+        double scale = 1e9 * cores / (double(hits) * threads);
+        std::cout << threads << " thread(s) on " << cores << " core(s), closest-hit scan: shared_ptr "
+                  << shared_time*1000 << "ms, raw " << raw_time*1000 << "ms, saving "
+                  << (shared_time - raw_time) * scale << "ns per hit (" << hits << " sphere hits per thread)" << std::endl;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// sphere_soa: SIMD blocks of spheres vs one virtual sphere::hit per object
+
+hittable_list to_list(const std::vector<shared_ptr<sphere>>& spheres) {
+    hittable_list list;
+    for (const auto& s : spheres) list.add(s);
+    return list;
+}
+
+// millions of closest-hit queries per second
+double mrays_per_second(const hittable& world, const std::vector<ray>& rays) {
+    double time = run_threads(1, [&](int) {
+        hit_record rec;
+        for (const auto& r : rays) world.hit(r, 0.001, infinity, rec);
+    });
+    return rays.size() / time * 1e-6;
+}
+
+void bench_sphere_soa() {
+    std::cout << "== sphere_soa vs hittable_list of spheres ==" << std::endl;
+    for (int n : {8, 32, 128}) {
+        auto spheres = sphere_field(n, 4, 0.3);
+        auto rays = random_rays(200000 / n * 8, 4);
+        hittable_list list = to_list(spheres);
+        sphere_soa soa(spheres);
+        std::cout << n << " spheres: list " << mrays_per_second(list, rays) << " Mrays/s, soa "
+                  << mrays_per_second(soa, rays) << " Mrays/s" << std::endl;
+    }
+
+    // the same trees with leaves intersected through the packed spheres and through virtual calls
+    auto spheres = sphere_field(100000, 100);
+    auto rays = random_rays(100000, 100);
+    hittable_list list = to_list(spheres);
+    flat_bvh binary = build_flat_bvh(list, bvh_builder::binned_sah, nullptr);
+    flat_bvh binary_virtual = binary;
+    binary_virtual.leaf_spheres.clear();
+    bvh8 wide(binary), wide_virtual(binary_virtual);
+    std::cout << "binary bvh, 100k spheres: virtual leaves " << mrays_per_second(binary_virtual, rays)
+              << " Mrays/s, soa leaves " << mrays_per_second(binary, rays) << " Mrays/s" << std::endl;
+    std::cout << "8-wide bvh, 100k spheres: virtual leaves " << mrays_per_second(wide_virtual, rays)
+              << " Mrays/s, soa leaves " << mrays_per_second(wide, rays) << " Mrays/s" << std::endl;
+}
+
+// ---------------------------------------------------------------------------------------------
+// closed primitive and material sets: switch on a tag vs virtual calls
+
+void bench_closed_dispatch() {
+    std::cout << "== closed primitive / material set vs virtual dispatch ==" << std::endl;
+    shared_ptr<material> mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    hittable_list list;
+    for (int i = 0; i < 64; i++) {
+        point3 c(random_double(-4, 4), random_double(0, 0.5), random_double(-4, 4));
+        if (i % 3 == 0) list.add(make_shared<sphere>(c, 0.3, mat));
+        else if (i % 3 == 1) list.add(make_shared<triangle>(c, c + vec3::random(-0.5, 0.5), c + vec3::random(-0.5, 0.5), mat));
+        else list.add(make_shared<box>(c - vec3(0.2, 0.2, 0.2), c + vec3(0.2, 0.2, 0.2), mat));
+    }
+    primitive_list closed(list);
+    auto rays = random_rays(200000, 4);
+    std::cout << "64 spheres/triangles/boxes: hittable_list " << mrays_per_second(list, rays) << " Mrays/s, primitive_list "
+              << mrays_per_second(closed, rays) << " Mrays/s" << std::endl;
+
+    std::vector<shared_ptr<material>> materials = {
+        make_shared<lambertian>(color(0.5, 0.5, 0.5)),
+        make_shared<metal>(color(0.7, 0.6, 0.5), 0.1),
+        make_shared<dielectric>(1.5),
+        make_shared<light>(color(4, 4, 4))
+    };
+    const int n = 1000000;
+    std::vector<const material*> hits(n);
+    for (int i = 0; i < n; i++) hits[i] = materials[rand() % materials.size()].get();
+    hit_record rec;
+    rec.p = point3(0, 0, 0);
+    rec.normal = vec3(0, 1, 0);
+    rec.front_face = true;
+    ray r(point3(0, 1, 1), vec3(0, -1, -1));
+    volatile double sink = 0; // keeps the calls from being optimized away
+    double virtual_time = run_threads(1, [&](int) {
+        ray scattered;
+        color attenuation;
+        for (const material* m : hits) {
+            if (m->scatter(r, rec, attenuation, scattered) || m->emanate(attenuation)) sink += attenuation.x();
+        }
+    });
+    double switch_time = run_threads(1, [&](int) {
+        ray scattered;
+        color attenuation;
+        for (const material* m : hits) {
+            if (scatter_material(*m, r, rec, attenuation, scattered) || emanate_material(*m, attenuation)) sink += attenuation.x();
+        }
+    });
+    std::cout << "material scatter: virtual " << virtual_time / n * 1e9 << "ns, switch " << switch_time / n * 1e9
+              << "ns per call" << std::endl;
+}
+
+// ---------------------------------------------------------------------------------------------
+// bvh disk cache: building vs mapping the cached tree
+
+void bench_bvh_cache() {
+    std::cout << "== bvh cache: build vs load ==" << std::endl;
+    const char* path = "bench_bvh.cache";
+    remove(path);
+    hittable_list list = to_list(sphere_field(1000000, 500));
+
+    for (bvh_builder builder : {bvh_builder::binned_sah, bvh_builder::lbvh}) {
+        auto start = bench_clock::now();
+        flat_bvh built = build_flat_bvh(list, builder, nullptr);
+        double build_time = seconds_since(start);
+        save_bvh_cache(path, list, builder, built, long(build_time * 1000));
+
+        flat_bvh loaded;
+        long cached_build_ms;
+        start = bench_clock::now();
+        bool ok = load_bvh_cache(path, list, builder, loaded, cached_build_ms);
+        double load_time = seconds_since(start);
+        bool same = ok && loaded.nodes.size() == built.nodes.size() && loaded.primitives == built.primitives
+                    && memcmp(loaded.nodes.data(), built.nodes.data(), built.nodes.size() * sizeof(flat_bvh_node)) == 0;
+        std::cout << bvh_builder_name(builder) << ", 1M spheres: build " << build_time*1000 << "ms, load "
+                  << load_time*1000 << "ms" << (same ? "" : " (LOADED TREE DIFFERS)") << std::endl;
+    }
+    remove(path);
+}
+
+// ---------------------------------------------------------------------------------------------
+// 8-wide nodes: full float boxes vs quantized compressed_bvh8_node
+
+// node memory counts the compressed leaf references too, speed is within a few percent either way
+void bench_compressed_nodes() {
+    std::cout << "== bvh8 nodes: full vs compressed ==" << std::endl;
+    for (int n : {100000, 1000000}) {
+        double extent = n == 100000 ? 100 : 300;
+        hittable_list list = to_list(sphere_field(n, extent));
+        auto rays = random_rays(200000, extent);
+        bvh8 full(build_flat_bvh(list, bvh_builder::binned_sah, nullptr));
+        compressed_bvh8 compressed(full);
+        std::cout << n / 1000 << "k spheres: full " << full.node_bytes() / 1024 << "KiB " << mrays_per_second(full, rays)
+                  << " Mrays/s, compressed " << compressed.node_bytes() / 1024 << "KiB " << mrays_per_second(compressed, rays)
+                  << " Mrays/s, " << double(full.node_bytes()) / compressed.node_bytes() << "x less node memory" << std::endl;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// treelet node layout: cache misses per ray and Mrays/s, depth-first vs reorder_treelets()
+
+// Set associative LRU cache of 64 byte lines. There is no perf in the sandboxes this runs in, so
+// misses are counted by feeding the node addresses a traversal touches through two of these.
+class cache_sim {
+public:
+    cache_sim(size_t lines, int ways) : ways(ways), sets(lines / ways), tags(sets * ways, ~uint64_t(0)) {}
+
+    // true on a miss, which then loads the line
+    bool access(uint64_t line) {
+        uint64_t* set = &tags[(line % sets) * ways];
+        int i = 0;
+        while (i < ways - 1 && set[i] != line) i++;
+        bool miss = set[i] != line;
+        // move to the front, the last entry (least recently used) falls out on a miss
+        for (; i > 0; i--) set[i] = set[i - 1];
+        set[0] = line;
+        return miss;
+    }
+
+private:
+    int ways;
+    size_t sets;
+    std::vector<uint64_t> tags; // per set, most recently used first
+};
+
+// wide_bvh::traverse with every node fetch going through the simulated L2 and LLC
+template <int N>
+void count_node_misses(const wide_bvh<N>& bvh, const ray& r, cache_sim& l2, cache_sim& llc, cache_sim& tlb, long& l2_misses, long& llc_misses, long& tlb_misses) {
+    flat_ray fr(r);
+    double closest_so_far = infinity;
+    hit_record rec;
+    uint32_t stack[max_bvh_depth * N];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0) {
+        uint32_t current = stack[--stack_size];
+        if (wide_is_leaf(current)) {
+            intersect_leaf<false>(bvh.primitives, bvh.leaf_spheres, bvh.leaf_closed, wide_leaf_offset(current),
+                                  wide_leaf_count(current), r, 0.001, infinity, closest_so_far, &rec);
+            continue;
+        }
+        const wide_bvh_node<N>& node = bvh.nodes[current];
+        if (tlb.access(reinterpret_cast<uintptr_t>(&node) / 4096)) tlb_misses++;
+        uint64_t first_line = reinterpret_cast<uintptr_t>(&node) / 64;
+        for (size_t l = 0; l < sizeof(node) / 64; l++) {
+            if (l2.access(first_line + l)) {
+                l2_misses++;
+                if (llc.access(first_line + l)) llc_misses++;
+            }
+        }
+        int mask = intersect_children<N>(node, fr, 0.001f, static_cast<float>(closest_so_far));
+        int order[N];
+        wide_child_order<N>(node.axis, fr, order);
+        for (int i = N-1; i >= 0; i--) {
+            if (mask & (1 << order[i])) stack[stack_size++] = node.child[order[i]];
+        }
+    }
+}
+
+template <int N>
+void report_treelets(const char* name, const wide_bvh<N>& bvh, const std::vector<ray>& rays) {
+    cache_sim l2((1 << 20) / 64, 16), llc((8 << 20) / 64, 16), tlb(1536, 12);
+    long l2_misses = 0, llc_misses = 0, tlb_misses = 0;
+    for (const auto& r : rays) count_node_misses(bvh, r, l2, llc, tlb, l2_misses, llc_misses, tlb_misses);
+    std::cout << "  " << name << ": " << double(l2_misses) / rays.size() << " L2 / " << double(llc_misses) / rays.size()
+              << " LLC / " << double(tlb_misses) / rays.size() << " TLB node misses per ray, " << mrays_per_second(bvh, rays) << " Mrays/s" << std::endl;
+}
+
+void bench_treelets() {
+    std::cout << "== wide bvh node layout: depth-first vs treelets (simulated 1MiB L2, 8MiB LLC, 1536 entry TLB) ==" << std::endl;
+    for (int n : {100000, 1000000}) {
+        double extent = n == 100000 ? 100 : 300;
+        hittable_list list = to_list(sphere_field(n, extent));
+        auto rays = random_rays(200000, extent);
+        auto start = bench_clock::now();
+        flat_bvh binary = build_flat_bvh(list, bvh_builder::binned_sah, nullptr);
+        bvh4 wide4(binary), treelets4(wide4);
+        bvh8 wide8(binary), treelets8(wide8);
+        double build_time = seconds_since(start);
+        start = bench_clock::now();
+        treelets4.reorder_treelets();
+        double reorder4_time = seconds_since(start);
+        start = bench_clock::now();
+        treelets8.reorder_treelets();
+        double reorder8_time = seconds_since(start);
+        std::cout << n / 1000 << "k spheres (build and collapse " << build_time * 1000 << "ms, treelet pass bvh4 "
+                  << reorder4_time * 1000 << "ms, bvh8 " << reorder8_time * 1000 << "ms):" << std::endl;
+        report_treelets("bvh4 depth-first", wide4, rays);
+        report_treelets("bvh4 treelets   ", treelets4, rays);
+        report_treelets("bvh8 depth-first", wide8, rays);
+        report_treelets("bvh8 treelets   ", treelets8, rays);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// primary rays: 8x8 packets with frustum culling vs one ray at a time
+
+// primary rays of a width x height image of scene_camera(), grouped into 8x8 tiles
+std::vector<ray_packet> primary_packets(const camera& cam, int width, int height) {
+    std::vector<ray_packet> packets;
+    for (int ty = 0; ty < height; ty += packet_width) {
+        for (int tx = 0; tx < width; tx += packet_width) {
+            ray_packet packet;
+            for (int j = ty; j < std::min(height, ty + packet_width); j++) {
+                for (int i = tx; i < std::min(width, tx + packet_width); i++) {
+                    packet.add(cam.get_ray((i + random_double()) / (width - 1), (j + random_double()) / (height - 1)));
+                }
+            }
+            packets.push_back(packet);
+        }
+    }
+    return packets;
+}
+
+void bench_packets() {
+    std::cout << "== primary rays: 8x8 packets vs single rays ==" << std::endl;
+    shared_ptr<material> ground = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    // the camera of main.cpp, without depth of field so the packets share an origin
+    camera cam(point3(13, 2, 3), point3(0, 1, 0), vec3(0, 1, 0), 20, 1.5, 0.0);
+    for (int n : {500, 50000}) {
+        hittable_list list = to_list(sphere_field(n, 11 * sqrt(n / 500.0)));
+        list.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground));
+        auto packets = primary_packets(cam, 1000, 666);
+        long rays = 0, mismatches = 0;
+        for (const auto& packet : packets) rays += packet.count;
+
+        for (bvh_kernel kernel : {bvh_kernel::sse_4wide, bvh_kernel::avx2_8wide}) {
+            shared_ptr<accelerator> world = make_bvh(list, kernel);
+            hit_record recs[packet_size];
+            bool hits[packet_size];
+            for (const auto& packet : packets) {
+                world->hit_packet(packet, 0.001, infinity, recs, hits);
+                for (int i = 0; i < packet.count; i++) {
+                    hit_record rec;
+                    bool hit = world->hit(packet.rays[i], 0.001, infinity, rec);
+                    if (hit != hits[i] || (hit && rec.t != recs[i].t)) mismatches++;
+                }
+            }
+            double single_time = run_threads(1, [&](int) {
+                hit_record rec;
+                for (const auto& packet : packets) {
+                    for (int i = 0; i < packet.count; i++) world->hit(packet.rays[i], 0.001, infinity, rec);
+                }
+            });
+            double packet_time = run_threads(1, [&](int) {
+                hit_record recs[packet_size];
+                bool hits[packet_size];
+                for (const auto& packet : packets) world->hit_packet(packet, 0.001, infinity, recs, hits);
+            });
+            std::cout << n << " spheres, " << bvh_kernel_name(kernel) << ": single " << rays / single_time * 1e-6
+                      << " Mrays/s, packets " << rays / packet_time * 1e-6 << " Mrays/s"
+                      << (mismatches ? " (PACKET HITS DIFFER)" : "") << std::endl;
+            if (mismatches) failed_checks++;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// secondary rays: traced in generation order vs sorted by direction octant and origin
+
+color bench_sky(const ray& r) {
+    vec3 unit_direction = unit_vector(r.direction());
+    auto y_linear = 0.5 * (unit_direction.y() + 1.0);
+    return (1.0 - y_linear)*color(1, 1, 1) + y_linear*color(0.5, 0.7, 1.0);
+}
+
+void bench_ray_sorting() {
+    std::cout << "== wavefront bounces: unsorted vs sorted secondary rays ==" << std::endl;
+    const int width = 600, height = 400, max_depth = 8;
+    camera cam(point3(13, 2, 3), point3(0, 1, 0), vec3(0, 1, 0), 20, 1.5, 0.1);
+    for (int n : {500, 200000}) {
+        hittable_list list = to_list(sphere_field(n, 11 * sqrt(n / 500.0)));
+        list.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+        shared_ptr<accelerator> world = make_bvh(list, detect_bvh_kernel());
+
+        std::vector<color> unsorted_pixels, sorted_pixels;
+        wavefront_stats unsorted, sorted;
+        render_wavefront(*world, cam, width, height, 1, max_depth, false, bench_sky, unsorted_pixels, &unsorted);
+        render_wavefront(*world, cam, width, height, 1, max_depth, true, bench_sky, sorted_pixels, &sorted);
+        // random numbers are keyed by pixel, so sorting must not change the image
+        bool same = true;
+        for (size_t p = 0; p < sorted_pixels.size(); p++) {
+            for (int k = 0; k < 3; k++) same &= sorted_pixels[p][k] == unsorted_pixels[p][k];
+        }
+        std::cout << n << " spheres (Mrays/s; sorted without / with the sort itself)"
+                  << (same ? "" : " (SORTED IMAGE DIFFERS)") << ":" << std::endl;
+        for (int depth = 0; depth < max_depth; depth++) {
+            if (unsorted.rays[depth] == 0 || sorted.rays[depth] == 0) break;
+            std::cout << "  bounce " << depth << ": " << sorted.rays[depth] << " rays, unsorted "
+                      << unsorted.rays[depth] / unsorted.trace_seconds[depth] * 1e-6 << ", sorted "
+                      << sorted.rays[depth] / sorted.trace_seconds[depth] * 1e-6 << " / "
+                      << sorted.rays[depth] / (sorted.trace_seconds[depth] + sorted.sort_seconds[depth]) * 1e-6 << std::endl;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// vec3 operations: scalar vs SIMD vec3 (make vec3_report builds this file both ways)
+
+// best time per element of f(i) over n elements
+template <typename F>
+double ns_per_op(int n, F f) {
+    return run_threads(1, [&](int) {
+        for (int i = 0; i < n; i++) f(i);
+    }) / n * 1e9;
+}
+
+void bench_vec3() {
+    std::cout << "== vec3 operations (" << vec3_backend() << ", " << (sizeof(real) == sizeof(float) ? "float" : "double")
+              << ", " << sizeof(vec3) << " bytes) ==" << std::endl;
+    const int n = 1 << 16;
+    std::vector<vec3> a(n), b(n), out(n);
+    std::vector<real> t(n), sums(n);
+    for (int i = 0; i < n; i++) {
+        a[i] = vec3::random(-1, 1);
+        b[i] = unit_vector(vec3::random(-1, 1));
+        t[i] = random_double(0.5, 1.5);
+    }
+    std::cout << "ns per op:"
+              << " a*t+b " << ns_per_op(n, [&](int i) { out[i] = a[i] * t[i] + b[i]; })
+              << ", dot " << ns_per_op(n, [&](int i) { sums[i] = dot(a[i], b[i]); })
+              << ", cross " << ns_per_op(n, [&](int i) { out[i] = cross(a[i], b[i]); })
+              << ", unit_vector " << ns_per_op(n, [&](int i) { out[i] = unit_vector(a[i]); })
+              << ", reflect " << ns_per_op(n, [&](int i) { out[i] = reflect(a[i], b[i]); })
+              << ", refract " << ns_per_op(n, [&](int i) { out[i] = refract(unit_vector(a[i]), b[i], t[i]); }) << std::endl;
+
+    // the same operations as they occur in the renderer
+    auto spheres = sphere_field(64, 4, 0.3);
+    auto rays = random_rays(100000, 4);
+    hittable_list list = to_list(spheres);
+    std::cout << "64 spheres, hittable_list: " << mrays_per_second(list, rays) << " Mrays/s" << std::endl;
+    hittable_list scene = to_list(sphere_field(500, 11));
+    scene.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    shared_ptr<accelerator> world = make_bvh(scene, detect_bvh_kernel());
+    camera cam(point3(13, 2, 3), point3(0, 1, 0), vec3(0, 1, 0), 20, 1.5, 0.1);
+    std::vector<color> pixels;
+    double render_time = run_threads(1, [&](int) {
+        render_wavefront(*world, cam, 300, 200, 1, 15, false, bench_sky, pixels);
+    }, 3);
+    std::cout << "500 spheres, 300x200 sample: " << render_time * 1e3 << "ms" << std::endl;
+}
+
+// ---------------------------------------------------------------------------------------------
+// random numbers: rand() (what random_double() used to call) vs a PCG32 generator per thread
+
+void bench_rng() {
+    std::cout << "== random numbers: rand() vs per thread rng ==" << std::endl;
+    const int n = 4000000;
+    for (int threads : {1, std::max(bench_threads(), 4)}) {
+        std::vector<double> sums(threads);
+        double rand_time = run_threads(threads, [&](int t) {
+            double sum = 0;
+            for (int i = 0; i < n; i++) sum += (double)rand() / RAND_MAX;
+            sums[t] = sum;
+        });
+        double rng_time = run_threads(threads, [&](int t) {
+            rng& gen = thread_rng();
+            double sum = 0;
+            for (int i = 0; i < n; i++) sum += random_double(gen);
+            sums[t] = sum;
+        });
+        double lookup_time = run_threads(threads, [&](int t) {
+            double sum = 0;
+            for (int i = 0; i < n; i++) sum += random_double();
+            sums[t] = sum;
+        });
+        std::cout << threads << " threads (M numbers/s): rand() " << threads * n / rand_time * 1e-6
+                  << ", thread rng " << threads * n / rng_time * 1e-6 << ", thread rng looked up per number "
+                  << threads * n / lookup_time * 1e-6 << std::endl;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// samplers: time to reach a target error against a reference image, per sampler
+
+// root mean square difference of the displayed (gamma corrected, clamped) colors
+double display_rmse(const std::vector<color>& sum, int samples, const std::vector<color>& reference) {
+    double squared = 0;
+    for (size_t p = 0; p < sum.size(); p++) {
+        for (int k = 0; k < 3; k++) {
+            double d = clamp(sqrt(sum[p][k] / samples), 0, 1) - clamp(sqrt(reference[p][k]), 0, 1);
+            squared += d * d;
+        }
+    }
+    return sqrt(squared / (3 * sum.size()));
+}
+
+void bench_samplers() {
+    std::cout << "== samplers: error vs a 512 sample reference (150x100 random_scene, depth 8) ==" << std::endl;
+    const int width = 150, height = 100, max_depth = 8, reference_samples = 512, max_samples = 64;
+    seed_rng(1);
+    hittable_list scene = random_scene();
+    shared_ptr<accelerator> world = make_bvh(scene, detect_bvh_kernel());
+    camera cam(point3(13, 2, 3), point3(0, 1, 0), vec3(0, 1, 0), 20, 1.5, 0.1);
+
+    // independent numbers from another seed, so the reference shares no samples with the renders
+    std::vector<color> reference(width * height), pixels;
+    seed_rng(1000);
+    for (int s = 0; s < reference_samples; s++) {
+        render_wavefront(*world, cam, width, height, s, max_depth, false, sky_color, pixels);
+        for (size_t p = 0; p < pixels.size(); p++) reference[p] += pixels[p];
+    }
+    for (auto& c : reference) c /= reference_samples;
+    seed_rng(1);
+
+    const sampler_kind kinds[] = {sampler_kind::independent, sampler_kind::halton, sampler_kind::sobol, sampler_kind::blue_noise};
+    std::vector<std::vector<double>> errors, times;
+    for (sampler_kind kind : kinds) {
+        shared_ptr<sampler> samples = make_sampler(kind);
+        std::vector<color> sum(width * height);
+        std::vector<double> kind_errors, kind_times;
+        double seconds = 0;
+        for (int s = 0; s < max_samples; s++) {
+            auto start = bench_clock::now();
+            render_wavefront(*world, cam, width, height, s, max_depth, false, sky_color, pixels, nullptr, nullptr, samples.get());
+            for (size_t p = 0; p < pixels.size(); p++) sum[p] += pixels[p];
+            seconds += seconds_since(start);
+            kind_errors.push_back(display_rmse(sum, s + 1, reference));
+            kind_times.push_back(seconds);
+        }
+        errors.push_back(kind_errors);
+        times.push_back(kind_times);
+    }
+
+    std::cout << "rmse at 1, 2, 4, ... " << max_samples << " samples:" << std::endl;
+    for (size_t k = 0; k < errors.size(); k++) {
+        std::cout << "  " << sampler_kind_name(kinds[k]) << ":";
+        for (int s = 1; s <= max_samples; s *= 2) std::cout << " " << errors[k][s - 1];
+        std::cout << std::endl;
+    }
+    // the error independent numbers reach at half the samples, so every sampler gets there
+    double target = errors[0][max_samples / 2 - 1];
+    std::cout << "time to rmse " << target << ":";
+    for (size_t k = 0; k < errors.size(); k++) {
+        size_t i = 0;
+        while (i < errors[k].size() && errors[k][i] > target) i++;
+        std::cout << " " << sampler_kind_name(kinds[k]) << " ";
+        if (i < errors[k].size()) std::cout << times[k][i] * 1e3 << "ms (" << i + 1 << " samples)";
+        else std::cout << "not reached";
+        std::cout << (k + 1 < errors.size() ? "," : "");
+    }
+    std::cout << std::endl;
+}
+
+// ---------------------------------------------------------------------------------------------
+// direction sampling: rejection loops (old) vs closed form, and a check of the distributions
+
+// random_in_unit_sphere and random_unit_vector as they were, drawing cubes until one lands in the ball
+vec3 rejection_in_unit_sphere(rng& gen) {
+    while (true) {
+        auto p = vec3::random(gen, -1, 1);
+        if (p.length_squared() >= 1) continue;
+        return p;
+    }
+}
+
+vec3 rejection_unit_vector(rng& gen) {
+    return unit_vector(rejection_in_unit_sphere(gen));
+}
+
+// Pearson's chi-square of counts against equal expected counts, and whether it is below the
+// 99.9% quantile for its degrees of freedom (Wilson-Hilferty approximation).
+bool chi_square_uniform(const std::vector<long>& counts, double& statistic) {
+    long total = 0;
+    for (long c : counts) total += c;
+    double expected = double(total) / counts.size();
+    statistic = 0;
+    for (long c : counts) statistic += (c - expected) * (c - expected) / expected;
+    double dof = counts.size() - 1, z = 3.09;
+    double quantile = dof * pow(1 - 2 / (9 * dof) + z * sqrt(2 / (9 * dof)), 3);
+    return statistic < quantile;
+}
+
+// Bins each sample into equal probability cells of its distribution, where the cell index is
+// computed from the point by inverting the mapping (cell(p) in [0, cells)), and flags points
+// outside the domain.
+template <typename S, typename C>
+void check_distribution(const char* name, S sample, C cell, int cells, bool (*inside)(const vec3&)) {
+    const int n = 2000000;
+    rng gen(42);
+    std::vector<long> counts(cells);
+    long outside = 0;
+    for (int i = 0; i < n; i++) {
+        vec3 p = sample(gen);
+        if (!inside(p)) outside++;
+        int c = cell(p);
+        counts[c < 0 ? 0 : c >= cells ? cells - 1 : c]++;
+    }
+    double statistic;
+    bool uniform = chi_square_uniform(counts, statistic);
+    if (!uniform || outside > 0) failed_checks++;
+    std::cout << "  " << name << ": chi-square " << statistic << " over " << cells << " cells, " << outside << " outside"
+              << (uniform && outside == 0 ? "" : " (DISTRIBUTION WRONG)") << std::endl;
+}
+
+int azimuth_cell(double x, double y, int bins) {
+    return static_cast<int>((atan2(y, x) / (2 * pi) + 0.5) * bins) % bins;
+}
+
+void bench_sampling() {
+    std::cout << "== direction sampling: rejection vs closed form ==" << std::endl;
+    const int n = 4000000;
+    rng gen(7);
+    std::vector<vec3> out(1024);
+    auto ns = [&](vec3 (*f)(rng&)) {
+        // through a function pointer, so every variant pays the same call
+        return run_threads(1, [&](int) {
+            for (int i = 0; i < n; i++) out[i & 1023] = f(gen);
+        }) / n * 1e9;
+    };
+    static const vec3 normal = unit_vector(vec3(0.3, 0.9, -0.2));
+    std::cout << "ns per sample: unit vector rejection " << ns(rejection_unit_vector)
+              << ", closed form " << ns([](rng& g) { return random_unit_vector(g); }) << std::endl;
+    std::cout << "ns per sample: in unit sphere rejection " << ns(rejection_in_unit_sphere)
+              << ", closed form " << ns([](rng& g) { return random_in_unit_sphere(g); }) << std::endl;
+    std::cout << "ns per sample: lambertian normal + unit vector (old) " << ns([](rng& g) { return normal + rejection_unit_vector(g); })
+              << ", cosine hemisphere " << ns([](rng& g) { return random_cosine_direction(normal, g); })
+              << ", unit disk " << ns([](rng& g) { return random_in_unit_disk(g); }) << std::endl;
+
+    // equal area cells: z and azimuth for the sphere, r^3 as well for the ball, r^2 and azimuth
+    // for the disk, and cos^2 of the angle to the normal and azimuth around it for the hemisphere
+    const int bins = 16;
+    std::cout << "distributions (2M samples each):" << std::endl;
+    check_distribution("unit sphere", [](rng& g) { return random_unit_vector(g); },
+        [&](const vec3& p) { return std::min(int((p.z() + 1) / 2 * bins), bins - 1) * bins + azimuth_cell(p.x(), p.y(), bins); },
+        bins * bins, [](const vec3& p) { return fabs(p.length() - 1) < 1e-5; });
+    check_distribution("unit ball", [](rng& g) { return random_in_unit_sphere(g); },
+        [&](const vec3& p) {
+            double r = p.length();
+            int shell = std::min(int(r * r * r * bins), bins - 1);
+            int z = std::min(int((p.z() / r + 1) / 2 * bins), bins - 1);
+            return (shell * bins + z) * bins + azimuth_cell(p.x(), p.y(), bins);
+        },
+        bins * bins * bins, [](const vec3& p) { return p.length_squared() <= 1; });
+    check_distribution("unit disk", [](rng& g) { return random_in_unit_disk(g); },
+        [&](const vec3& p) { return std::min(int(p.length_squared() * bins), bins - 1) * bins + azimuth_cell(p.x(), p.y(), bins); },
+        bins * bins, [](const vec3& p) { return p.length_squared() <= 1 && p.z() == 0; });
+    // the frame the hemisphere is checked in, built independently of the sampler's own basis
+    vec3 tangent = unit_vector(cross(fabs(normal.x()) > 0.5 ? vec3(0, 1, 0) : vec3(1, 0, 0), normal));
+    vec3 bitangent = cross(normal, tangent);
+    check_distribution("cosine hemisphere", [&](rng& g) { return random_cosine_direction(normal, g); },
+        [&](const vec3& p) {
+            double c = dot(p, normal);
+            return std::min(int(c * c * bins), bins - 1) * bins + azimuth_cell(dot(p, tangent), dot(p, bitangent), bins);
+        },
+        bins * bins, [](const vec3& p) { return fabs(p.length() - 1) < 1e-5; });
+}
+
+// ---------------------------------------------------------------------------------------------
+// batch random numbers: 8 PCG32 lanes per call (rng_x8) vs one rng call per number, and the
+// camera numbers of a tile drawn together (camera_samples) vs a sample_stream per pixel
+
+void bench_batch_rng() {
+    std::cout << "== batch random numbers (" << (cpu_has_avx2() ? "avx2" : "scalar") << ") ==" << std::endl;
+    const int n = 1 << 22;
+    std::vector<double> out(4096);
+    rng gen(7);
+    double scalar_time = run_threads(1, [&](int) {
+        for (int i = 0; i < n; i++) out[i & 4095] = random_double(gen);
+    });
+    uint64_t seeds[rng_x8::lanes];
+    for (int k = 0; k < rng_x8::lanes; k++) seeds[k] = mix64(k);
+    rng_x8 lanes;
+    lanes.reseed(seeds);
+    std::cout << "ns per number: rng " << scalar_time / n * 1e9;
+    for (int batch : {8, 16, 4096}) {
+        double batch_time = run_threads(1, [&](int) {
+            for (int i = 0; i < n; i += batch) lanes.fill_doubles(&out[i & 4095 & ~(batch - 1)], batch);
+        });
+        std::cout << ", rng_x8 " << batch << " per call " << batch_time / n * 1e9;
+    }
+    std::cout << std::endl;
+
+    // every lane must be the scalar generator with its seed
+    lanes.reseed(seeds, 3);
+    std::vector<rng> reference;
+    for (int k = 0; k < rng_x8::lanes; k++) reference.push_back(rng(seeds[k], 3));
+    long mismatches = 0;
+    for (int round = 0; round < 1000; round++) {
+        uint32_t numbers[rng_x8::lanes];
+        lanes.next_u32(numbers);
+        for (int k = 0; k < rng_x8::lanes; k++) mismatches += numbers[k] != reference[k].next_u32();
+        lanes.fill_doubles(&out[0], 16);
+        for (int i = 0; i < 16; i++) mismatches += out[i] != reference[i % rng_x8::lanes].next_double();
+    }
+    std::cout << "lanes differing from rng: " << mismatches << std::endl;
+
+    // camera numbers of a 300x200 image in 8x8 tiles like render_wavefront, with independent
+    // numbers and with sobol, checked against the numbers of a sample_stream per pixel
+    const int width = 300, height = 200, samples_per_pixel = 8;
+    shared_ptr<sampler> sobol = make_sampler(sampler_kind::sobol);
+    for (const sampler* samples : {(const sampler*)nullptr, (const sampler*)sobol.get()}) {
+        std::vector<camera_sample> expected, batched;
+        auto numbers = [&](bool tiles, std::vector<camera_sample>& out) {
+            out.clear();
+            path_key keys[packet_size];
+            camera_sample tile[packet_size];
+            for (int s = 0; s < samples_per_pixel; s++) {
+                for (int tile_j = height-1; tile_j >= 0; tile_j -= packet_width) {
+                    for (int tile_i = 0; tile_i < width; tile_i += packet_width) {
+                        int count = 0;
+                        for (int j = tile_j; j > tile_j - packet_width && j >= 0; --j) {
+                            for (int i = tile_i; i < tile_i + packet_width && i < width; ++i) {
+                                keys[count++] = path_key{rng_seed(), uint32_t(i), uint32_t(j), uint32_t(s), samples};
+                            }
+                        }
+                        if (tiles) {
+                            camera_samples(keys, count, tile);
+                        } else {
+                            for (int k = 0; k < count; k++) {
+                                sample_stream stream = keys[k].bounce(0);
+                                for (uint32_t d = 0; d < sampler_dimensions_per_bounce; d++) tile[k].values[d] = stream.next_double();
+                            }
+                        }
+                        // sample 0 is kept for the comparison
+                        if (s == 0) out.insert(out.end(), tile, tile + count);
+                    }
+                }
+            }
+        };
+        double stream_time = run_threads(1, [&](int) { numbers(false, expected); });
+        double tile_time = run_threads(1, [&](int) { numbers(true, batched); });
+        long differing = 0;
+        for (size_t p = 0; p < expected.size(); p++) {
+            for (uint32_t d = 0; d < sampler_dimensions_per_bounce; d++) differing += batched[p].values[d] != expected[p].values[d];
+        }
+        double pixels = double(width) * height * samples_per_pixel;
+        std::cout << "camera numbers, " << (samples ? "sobol" : "independent") << " (ns per pixel): sample_stream per pixel "
+                  << stream_time / pixels * 1e9 << ", camera_samples per tile " << tile_time / pixels * 1e9
+                  << ", numbers differing " << differing << std::endl;
+    }
+}
+
+// runs every section, or only the ones named on the command line (./bench vec3 packets)
+int main(int argc, char** argv) {
+    const std::pair<const char*, void (*)()> sections[] = {
+        {"material_pointer", bench_material_pointer},
+        {"sphere_soa", bench_sphere_soa},
+        {"closed_dispatch", bench_closed_dispatch},
+        {"bvh_cache", bench_bvh_cache},
+        {"compressed_nodes", bench_compressed_nodes},
+        {"treelets", bench_treelets},
+        {"packets", bench_packets},
+        {"ray_sorting", bench_ray_sorting},
+        {"vec3", bench_vec3},
+        {"rng", bench_rng},
+        {"samplers", bench_samplers},
+        {"sampling", bench_sampling},
+        {"batch_rng", bench_batch_rng}
+    };
+    for (const auto& section : sections) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; i++) selected |= std::string(argv[i]) == section.first;
+        if (selected) section.second();
+    }
+    if (failed_checks) std::cerr << failed_checks << " check(s) failed" << std::endl;
+    return failed_checks ? 1 : 0;
+}
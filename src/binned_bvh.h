@@ -0,0 +1,294 @@
+#ifndef BINNED_BVH_H
+#define BINNED_BVH_H
+
+#include "flat_bvh.h"
+#include "threadpool.h"
+
+// number of centroid bins per axis the SAH is evaluated on
+const int sah_bin_count = 32;
+// ranges with at least this many primitives have their bounds and bins filled by all pool threads
+const size_t parallel_binning_threshold = 1 << 16;
+// ranges with at most this many primitives are built as one subtree by a single thread
+const size_t subtree_task_size = 1 << 12;
+
+struct sah_bin {
+    aabb box;
+    size_t count = 0;
+};
+
+// Binned SAH builder producing a flat_bvh. The top of the tree is split on the calling thread
+// (with bounds and bins computed in parallel chunks for big ranges), the remaining subtrees are
+// built as independent pool jobs and stitched back in depth-first order. Every split only depends
+// on the primitives of its range, and chunk results are reduced in a fixed order, so the tree is
+// the same for every run and every thread count.
+class binned_bvh_builder {
+public:
+    binned_bvh_builder(threadPool* pool = nullptr) : pool(pool) {}
+
+    void build(const hittable_list& list, flat_bvh& out) {
+        prims = make_bvh_primitives(list.get_objects());
+        top.clear();
+        tasks.clear();
+        out.nodes.clear();
+        out.primitives.clear();
+        out.leaf_spheres.clear();
+        out.leaf_closed.clear();
+        if (prims.empty()) return;
+
+        int root = build_top(0, prims.size(), 0);
+
+        if (pool && tasks.size() > 1) {
+            for (auto& task : tasks) {
+                subtree* t = &task;
+                pool->queueJob([this, t] { build_subtree(*t); });
+            }
+            pool->wait();
+        } else {
+            for (auto& task : tasks) build_subtree(task);
+        }
+
+        out.nodes.reserve(2 * prims.size());
+        emit(root, out);
+        out.primitives.reserve(prims.size());
+        for (const auto& prim : prims) out.primitives.push_back(prim.object);
+        out.pack_leaves();
+    }
+
+private:
+    struct top_node {
+        aabb box;
+        int axis;
+        int left;
+        int right;
+        int task; // index into tasks for subtree roots, -1 for interior nodes
+    };
+
+    struct subtree {
+        size_t start;
+        size_t end;
+        int depth;
+        std::vector<flat_bvh_node> nodes; // second_child_offset relative to the subtree root
+    };
+
+    struct split {
+        aabb box;
+        bool leaf;
+        int axis;
+        size_t mid;
+    };
+
+    threadPool* pool;
+    std::vector<bvh_primitive> prims;
+    std::vector<top_node> top;
+    std::vector<subtree> tasks;
+
+    int chunk_count(size_t n) const {
+        if (!pool || n < parallel_binning_threshold) return 1;
+        return pool->size();
+    }
+
+    // binned SAH evaluation of prims[start, end), partitions the range when it decides to split
+    split find_split(size_t start, size_t end, int depth) {
+        size_t n = end - start;
+        int chunks = chunk_count(n);
+
+        split s;
+        aabb centroids;
+        if (chunks == 1) {
+            range_bounds(start, end, s.box, centroids);
+        } else {
+            std::vector<aabb> chunk_box(chunks), chunk_centroids(chunks);
+            parallel_chunks(pool, start, end, chunks, [&](int c, size_t cs, size_t ce) {
+                range_bounds(cs, ce, chunk_box[c], chunk_centroids[c]);
+            });
+            for (int c = 0; c < chunks; c++) {
+                s.box = surrounding_box(s.box, chunk_box[c]);
+                centroids = surrounding_box(centroids, chunk_centroids[c]);
+            }
+        }
+        s.leaf = true;
+        s.axis = 0;
+        s.mid = start + n/2;
+        if (n == 1) return s;
+
+        // all centroids in one spot or tree too deep, SAH can't help, split in the middle
+        int longest = centroids.longest_axis();
+        bool degenerate = centroids.max()[longest] <= centroids.min()[longest];
+        if (degenerate || depth >= max_bvh_depth/2) {
+            if (n <= max_prims_in_leaf) return s;
+            s.leaf = false;
+            s.axis = longest;
+            int axis = longest;
+            std::nth_element(prims.begin() + start, prims.begin() + s.mid, prims.begin() + end,
+                [axis](const bvh_primitive& a, const bvh_primitive& b) { return a.centroid[axis] < b.centroid[axis]; });
+            return s;
+        }
+
+        // small ranges don't need many bins, this keeps the cost of the bottom levels down
+        int bin_count = n < size_t(sah_bin_count) ? int(n) : sah_bin_count;
+        sah_bin bins[3][sah_bin_count];
+        if (chunks == 1) {
+            fill_bins(start, end, centroids, bin_count, bins);
+        } else {
+            std::vector<sah_bin> chunk_bins(chunks * 3 * sah_bin_count);
+            parallel_chunks(pool, start, end, chunks, [&](int c, size_t cs, size_t ce) {
+                fill_bins(cs, ce, centroids, bin_count, reinterpret_cast<sah_bin(*)[sah_bin_count]>(&chunk_bins[c * 3 * sah_bin_count]));
+            });
+            for (int c = 0; c < chunks; c++) {
+                for (int a = 0; a < 3; a++) {
+                    for (int b = 0; b < bin_count; b++) {
+                        const sah_bin& cb = chunk_bins[(c*3 + a)*sah_bin_count + b];
+                        bins[a][b].count += cb.count;
+                        bins[a][b].box = surrounding_box(bins[a][b].box, cb.box);
+                    }
+                }
+            }
+        }
+
+        // sweep the bin boundaries of every axis, same cost model as sah_split
+        double best_cost = infinity;
+        int best_axis = -1, best_bin = 0;
+        for (int a = 0; a < 3; a++) {
+            if (centroids.max()[a] <= centroids.min()[a]) continue;
+            double right_area[sah_bin_count];
+            size_t right_count[sah_bin_count];
+            aabb right_box;
+            size_t count = 0;
+            for (int b = bin_count-1; b > 0; b--) {
+                right_box = surrounding_box(right_box, bins[a][b].box);
+                count += bins[a][b].count;
+                right_area[b] = right_box.surface_area();
+                right_count[b] = count;
+            }
+            aabb left_box;
+            count = 0;
+            for (int b = 1; b < bin_count; b++) {
+                left_box = surrounding_box(left_box, bins[a][b-1].box);
+                count += bins[a][b-1].count;
+                if (count == 0 || right_count[b] == 0) continue;
+                double cost = left_box.surface_area()*count + right_area[b]*right_count[b];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = a;
+                    best_bin = b;
+                }
+            }
+        }
+
+        double parent_area = s.box.surface_area();
+        best_cost = parent_area > 0 ? sah_traversal_cost + best_cost/parent_area : sah_traversal_cost + n;
+        if (n <= max_prims_in_leaf && n <= best_cost) return s;
+
+        s.leaf = false;
+        s.axis = best_axis;
+        auto first_right = std::partition(prims.begin() + start, prims.begin() + end,
+            [&](const bvh_primitive& p) { return bin_index(p.centroid[best_axis], centroids, best_axis, bin_count) < best_bin; });
+        s.mid = first_right - prims.begin();
+        return s;
+    }
+
+    void range_bounds(size_t start, size_t end, aabb& box, aabb& centroids) const {
+        for (size_t i = start; i < end; i++) {
+            box = surrounding_box(box, prims[i].box);
+            centroids = surrounding_box(centroids, aabb(prims[i].centroid, prims[i].centroid));
+        }
+    }
+
+    void fill_bins(size_t start, size_t end, const aabb& centroids, int bin_count, sah_bin bins[][sah_bin_count]) const {
+        // axes where all centroids coincide can't be split along and are skipped by the sweep,
+        // binning them would divide 0 by 0
+        bool binned[3];
+        for (int a = 0; a < 3; a++) binned[a] = centroids.max()[a] > centroids.min()[a];
+        for (size_t i = start; i < end; i++) {
+            for (int a = 0; a < 3; a++) {
+                if (!binned[a]) continue;
+                sah_bin& bin = bins[a][bin_index(prims[i].centroid[a], centroids, a, bin_count)];
+                bin.count++;
+                bin.box = surrounding_box(bin.box, prims[i].box);
+            }
+        }
+    }
+
+    static int bin_index(double c, const aabb& centroids, int axis, int bin_count) {
+        double lo = centroids.min()[axis], hi = centroids.max()[axis];
+        if (hi <= lo) return 0;
+        int b = static_cast<int>(bin_count * (c - lo) / (hi - lo));
+        return b < 0 ? 0 : (b >= bin_count ? bin_count - 1 : b);
+    }
+
+    // splits large ranges on this thread until they are small enough to become subtree tasks
+    int build_top(size_t start, size_t end, int depth) {
+        int index = static_cast<int>(top.size());
+        top.emplace_back();
+        top[index].task = -1;
+
+        if (end - start <= subtree_task_size) {
+            top[index].task = static_cast<int>(tasks.size());
+            tasks.push_back(subtree{start, end, depth, {}});
+            return index;
+        }
+
+        split s = find_split(start, end, depth);
+        if (s.leaf) {
+            top[index].task = static_cast<int>(tasks.size());
+            tasks.push_back(subtree{start, end, depth, {}});
+            return index;
+        }
+        top[index].box = s.box;
+        top[index].axis = s.axis;
+        int left = build_top(start, s.mid, depth + 1);
+        int right = build_top(s.mid, end, depth + 1);
+        top[index].left = left;
+        top[index].right = right;
+        return index;
+    }
+
+    void build_subtree(subtree& t) {
+        t.nodes.reserve(2 * (t.end - t.start));
+        build_node(t, t.start, t.end, t.depth);
+    }
+
+    int build_node(subtree& t, size_t start, size_t end, int depth) {
+        int index = static_cast<int>(t.nodes.size());
+        t.nodes.emplace_back();
+
+        split s = find_split(start, end, depth);
+        if (s.leaf) {
+            t.nodes[index].primitives_offset = static_cast<int32_t>(start);
+            t.nodes[index].n_primitives = static_cast<uint16_t>(end - start);
+        } else {
+            t.nodes[index].n_primitives = 0;
+            t.nodes[index].axis = static_cast<uint8_t>(s.axis);
+            build_node(t, start, s.mid, depth + 1);
+            int second = build_node(t, s.mid, end, depth + 1);
+            t.nodes[index].second_child_offset = second;
+        }
+        t.nodes[index].set_bounds(s.box);
+        return index;
+    }
+
+    // writes the top tree and the finished subtrees into one depth-first node array
+    void emit(int t, flat_bvh& out) {
+        const top_node& tn = top[t];
+        if (tn.task >= 0) {
+            int32_t base = static_cast<int32_t>(out.nodes.size());
+            for (flat_bvh_node node : tasks[tn.task].nodes) {
+                if (node.n_primitives == 0) node.second_child_offset += base;
+                out.nodes.push_back(node);
+            }
+            return;
+        }
+
+        int index = static_cast<int>(out.nodes.size());
+        out.nodes.emplace_back();
+        out.nodes[index].n_primitives = 0;
+        out.nodes[index].axis = static_cast<uint8_t>(tn.axis);
+        out.nodes[index].set_bounds(tn.box);
+        emit(tn.left, out);
+        int second = static_cast<int>(out.nodes.size());
+        emit(tn.right, out);
+        out.nodes[index].second_child_offset = second;
+    }
+};
+
+#endif
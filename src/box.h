@@ -0,0 +1,66 @@
+#ifndef BOX_H
+#define BOX_H
+
+#include "common.h"
+#include <utility>
+
+// Solid axis aligned box: slab test that also remembers which slab the ray entered (or, from
+// inside the box, left) through, since that face's normal is the surface normal.
+// Fills everything in rec but the material.
+inline bool hit_box(const point3& minimum, const point3& maximum, const ray& r, double t_min, double t_max, hit_record& rec) {
+    double t_near = -infinity, t_far = infinity;
+    int near_axis = 0, far_axis = 0;
+    for (int a = 0; a < 3; a++) {
+        auto inv_d = 1.0 / r.direction()[a];
+        auto t0 = (minimum[a] - r.origin()[a]) * inv_d;
+        auto t1 = (maximum[a] - r.origin()[a]) * inv_d;
+        if (inv_d < 0.0) std::swap(t0, t1);
+        if (t0 > t_near) {
+            t_near = t0;
+            near_axis = a;
+        }
+        if (t1 < t_far) {
+            t_far = t1;
+            far_axis = a;
+        }
+        if (t_far < t_near) return false;
+    }
+
+    auto t = t_near;
+    int axis = near_axis;
+    if (t < t_min || t > t_max) {
+        t = t_far;
+        axis = far_axis;
+        if (t < t_min || t > t_max) return false;
+    }
+
+    rec.t = t;
+    rec.p = r.at(t);
+    vec3 outward_normal(0, 0, 0);
+    outward_normal[axis] = rec.p[axis] - minimum[axis] < maximum[axis] - rec.p[axis] ? -1 : 1;
+    rec.set_face_normal(r, outward_normal);
+    return true;
+}
+
+class box : public hittable {
+public:
+    point3 minimum;
+    point3 maximum;
+    shared_ptr<material> mat;
+
+    box() = default;
+    box(const point3& a, const point3& b, shared_ptr<material> m) : minimum(a), maximum(b), mat(m) {}
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        if (!hit_box(minimum, maximum, r, t_min, t_max, rec)) return false;
+        rec.mat_ptr = mat.get();
+        return true;
+    }
+
+    bool bounding_box(aabb& output_box) const override {
+        output_box = aabb(minimum, maximum);
+        return true;
+    }
+};
+
+#endif
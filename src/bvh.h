@@ -0,0 +1,157 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "common.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+// relative cost of visiting one bvh node compared to intersecting one primitive
+const double sah_traversal_cost = 0.125;
+
+// object plus its cached bounds, so the builder never calls bounding_box() more than once per object
+struct bvh_primitive {
+    shared_ptr<hittable> object;
+    aabb box;
+    point3 centroid;
+};
+
+// Objects without a bounding box (plane, an empty list) have no centroid to sort by and no cell to
+// go in. They are moved to unbounded for the caller to test on every ray, or without that list
+// rejected, since a tree can't hold them.
+inline std::vector<bvh_primitive> make_bvh_primitives(const std::vector<shared_ptr<hittable>>& objects,
+                                                      std::vector<shared_ptr<hittable>>* unbounded = nullptr) {
+    std::vector<bvh_primitive> prims;
+    prims.reserve(objects.size());
+    for (const auto& object : objects) {
+        bvh_primitive prim;
+        if (!object->bounding_box(prim.box)) {
+            if (!unbounded) throw std::invalid_argument("object without a bounding box in bvh constructor");
+            unbounded->push_back(object);
+            continue;
+        }
+        prim.object = object;
+        prim.centroid = prim.box.centroid();
+        prims.push_back(prim);
+    }
+    return prims;
+}
+
+// Surface area heuristic: a ray that hits the parent box hits a child with probability
+// area(child) / area(parent), so the expected cost of a split is
+//     traversal + (area(L)*count(L) + area(R)*count(R)) / area(parent)
+// Tries every split position along every axis (sorted by centroid) and leaves prims[start, end)
+// sorted along the best axis. Returns the index of the first primitive in the right half and
+// writes the chosen axis and the expected cost of the split (in units of primitive intersections).
+inline size_t sah_split(std::vector<bvh_primitive>& prims, size_t start, size_t end, int& split_axis, double& split_cost) {
+    size_t n = end - start;
+    aabb parent;
+    for (size_t i = start; i < end; i++) parent = surrounding_box(parent, prims[i].box);
+    double parent_area = parent.surface_area();
+
+    std::vector<double> right_area(n);
+    int best_axis = 0;
+    size_t best_mid = start + n/2;
+    split_cost = infinity;
+
+    for (int axis = 0; axis < 3; axis++) {
+        std::sort(prims.begin() + start, prims.begin() + end,
+            [axis](const bvh_primitive& a, const bvh_primitive& b) { return a.centroid[axis] < b.centroid[axis]; });
+
+        // sweep from the right to get the area of every suffix, then from the left to score each split
+        aabb right_box;
+        for (size_t i = n-1; i > 0; i--) {
+            right_box = surrounding_box(right_box, prims[start + i].box);
+            right_area[i] = right_box.surface_area();
+        }
+        aabb left_box;
+        for (size_t i = 1; i < n; i++) {
+            left_box = surrounding_box(left_box, prims[start + i - 1].box);
+            double cost = left_box.surface_area()*i + right_area[i]*(n-i);
+            if (cost < split_cost) {
+                split_cost = cost;
+                best_axis = axis;
+                best_mid = start + i;
+            }
+        }
+    }
+
+    split_cost = parent_area > 0 ? sah_traversal_cost + split_cost/parent_area : sah_traversal_cost + n;
+
+    split_axis = best_axis;
+    if (best_axis != 2) {
+        std::sort(prims.begin() + start, prims.begin() + end,
+            [best_axis](const bvh_primitive& a, const bvh_primitive& b) { return a.centroid[best_axis] < b.centroid[best_axis]; });
+    }
+    return best_mid;
+}
+
+// sah_split for builders that only want the split position, not the cost to compare with a leaf
+inline size_t sah_split(std::vector<bvh_primitive>& prims, size_t start, size_t end, int& split_axis) {
+    double split_cost;
+    return sah_split(prims, start, end, split_axis, split_cost);
+}
+
+// binary bounding volume hierarchy, each node holds its two subtrees (or one/two objects at the leaves)
+class bvh_node : public hittable {
+public:
+    shared_ptr<hittable> left;
+    shared_ptr<hittable> right;
+    aabb box;
+
+    bvh_node() = default;
+    bvh_node(const hittable_list& list) {
+        auto prims = make_bvh_primitives(list.get_objects());
+        build(prims, 0, prims.size());
+    }
+    bvh_node(std::vector<bvh_primitive>& prims, size_t start, size_t end) { build(prims, start, end); }
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        if (!box.hit(r, t_min, t_max)) return false;
+
+        bool hit_left = left->hit(r, t_min, t_max, rec);
+        bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+        return hit_left || hit_right;
+    }
+
+    bool occluded(const ray& r, double t_min, double t_max) const override {
+        if (!box.hit(r, t_min, t_max)) return false;
+        return left->occluded(r, t_min, t_max) || right->occluded(r, t_min, t_max);
+    }
+
+    bool bounding_box(aabb& output_box) const override {
+        output_box = box;
+        return true;
+    }
+
+private:
+    void build(std::vector<bvh_primitive>& prims, size_t start, size_t end) {
+        size_t n = end - start;
+        if (n == 0) {
+            std::cerr << "Empty object list in bvh_node constructor." << std::endl;
+            return;
+        }
+
+        if (n == 1) {
+            left = right = prims[start].object;
+        } else if (n == 2) {
+            left = prims[start].object;
+            right = prims[start+1].object;
+        } else {
+            // a bvh_node holds at most 2 objects itself, so there is no bigger leaf for the SAH
+            // cost to pick over splitting (flat_bvh, whose leaves hold ranges, compares the two)
+            int axis;
+            size_t mid = sah_split(prims, start, end, axis);
+            left = make_shared<bvh_node>(prims, start, mid);
+            right = make_shared<bvh_node>(prims, mid, end);
+        }
+
+        aabb box_left, box_right;
+        left->bounding_box(box_left);
+        right->bounding_box(box_right);
+        box = surrounding_box(box_left, box_right);
+    }
+};
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include "accel.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <unordered_map>
+
+// bump whenever flat_bvh_node or the file layout below changes, older files are then rebuilt
+const uint32_t bvh_cache_version = 1;
+const char bvh_cache_magic[8] = {'R', 'A', 'Y', 'B', 'V', 'H', '\0', '\0'};
+// written as is, reads back differently on a machine with the other byte order
+const uint32_t bvh_cache_byte_order = 0x01020304;
+
+// File layout: this header, the flat_bvh nodes, then for every primitive in leaf order its
+// index in the scene's hittable_list. Nodes start at byte 64 so they keep their alignment.
+struct bvh_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t scene_hash;
+    uint32_t builder;
+    uint32_t build_ms;  // how long the cached build took, for the startup log
+    uint64_t node_count;
+    uint64_t primitive_count;
+    uint8_t pad[16];
+};
+
+static_assert(sizeof(bvh_cache_header) == 64, "bvh_cache_header must stay 64 bytes");
+
+// FNV-1a, one 64-bit word at a time instead of byte by byte
+inline uint64_t hash_words(uint64_t hash, const uint64_t* words, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        hash ^= words[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// A tree only depends on the builder and the bounding box of every object in list order,
+// so that is what identifies it. Moving, adding or removing an object changes the hash,
+// changing a material doesn't (and doesn't need a new tree).
+inline uint64_t scene_hash(const hittable_list& list, bvh_builder builder) {
+    uint64_t header[2] = {static_cast<uint64_t>(builder), list.get_objects().size()};
+    uint64_t hash = hash_words(14695981039346656037ull, header, 2);
+    for (const auto& object : list.get_objects()) {
+        aabb box;
+        object->bounding_box(box);
+        double bounds[6] = {box.min().x(), box.min().y(), box.min().z(), box.max().x(), box.max().y(), box.max().z()};
+        uint64_t words[6];
+        memcpy(words, bounds, sizeof(words));
+        hash = hash_words(hash, words, 6);
+    }
+    return hash;
+}
+
+inline bool save_bvh_cache(const char* path, const hittable_list& list, bvh_builder builder, const flat_bvh& bvh, long build_ms) {
+    std::unordered_map<const hittable*, uint32_t> index;
+    const auto& objects = list.get_objects();
+    for (size_t i = 0; i < objects.size(); i++) index[objects[i].get()] = static_cast<uint32_t>(i);
+    std::vector<uint32_t> order;
+    order.reserve(bvh.primitives.size());
+    for (const auto& object : bvh.primitives) order.push_back(index.at(object.get()));
+
+    bvh_cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, bvh_cache_magic, sizeof(header.magic));
+    header.version = bvh_cache_version;
+    header.byte_order = bvh_cache_byte_order;
+    header.scene_hash = scene_hash(list, builder);
+    header.builder = static_cast<uint32_t>(builder);
+    header.build_ms = static_cast<uint32_t>(build_ms);
+    header.node_count = bvh.nodes.size();
+    header.primitive_count = order.size();
+
+    // write to a temporary name and rename, so a crash never leaves a half written cache behind
+    std::string temp = std::string(path) + ".tmp";
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (!file) return false;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(bvh.nodes.data(), sizeof(flat_bvh_node), bvh.nodes.size(), file) == bvh.nodes.size()
+        && fwrite(order.data(), sizeof(uint32_t), order.size(), file) == order.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temp.c_str(), path) != 0) {
+        remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Maps the cache file and, if it was written for this scene and builder, fills bvh from it.
+// Returns false (leaving bvh untouched) for a missing, stale or damaged file. On success
+// build_ms is set to how long the original build took.
+inline bool load_bvh_cache(const char* path, const hittable_list& list, bvh_builder builder, flat_bvh& bvh, long& build_ms) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(bvh_cache_header)) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) return false;
+
+    const char* data = static_cast<const char*>(mapped);
+    const bvh_cache_header& header = *reinterpret_cast<const bvh_cache_header*>(data);
+    const auto& objects = list.get_objects();
+    bool ok = memcmp(header.magic, bvh_cache_magic, sizeof(header.magic)) == 0
+        && header.version == bvh_cache_version
+        && header.byte_order == bvh_cache_byte_order
+        && header.builder == static_cast<uint32_t>(builder)
+        && header.primitive_count == objects.size()
+        && header.node_count <= size / sizeof(flat_bvh_node)
+        && size == sizeof(header) + header.node_count * sizeof(flat_bvh_node) + header.primitive_count * sizeof(uint32_t)
+        && header.scene_hash == scene_hash(list, builder);
+
+    const flat_bvh_node* nodes = reinterpret_cast<const flat_bvh_node*>(data + sizeof(header));
+    const uint32_t* order = reinterpret_cast<const uint32_t*>(data + sizeof(header) + header.node_count * sizeof(flat_bvh_node));
+    // the hash says the file belongs to this scene, this makes sure traversal can't index out of
+    // bounds or overflow its stack. Children always come after their parent, so one forward pass
+    // sees every node's depth before its children.
+    std::vector<uint8_t> depth(ok ? header.node_count : 0, 0);
+    for (size_t i = 0; ok && i < header.node_count; i++) {
+        const flat_bvh_node& node = nodes[i];
+        if (node.n_primitives > 0) {
+            ok = node.primitives_offset >= 0 && uint64_t(node.primitives_offset) + node.n_primitives <= header.primitive_count;
+        } else {
+            ok = node.axis < 3 && depth[i] + 1 < max_bvh_depth && i + 1 < header.node_count
+                && uint64_t(node.second_child_offset) > i + 1 && uint64_t(node.second_child_offset) < header.node_count;
+            if (ok) depth[i + 1] = depth[node.second_child_offset] = depth[i] + 1;
+        }
+    }
+    for (size_t i = 0; ok && i < header.primitive_count; i++) ok = order[i] < objects.size();
+
+    if (ok) {
+        bvh.nodes.assign(nodes, nodes + header.node_count);
+        bvh.primitives.clear();
+        bvh.primitives.reserve(header.primitive_count);
+        for (size_t i = 0; i < header.primitive_count; i++) bvh.primitives.push_back(objects[order[i]]);
+        bvh.pack_leaves();
+        build_ms = header.build_ms;
+    }
+    munmap(mapped, size);
+    return ok;
+}
+
+// Loads the tree for list from the cache file at path, or builds it and writes the cache.
+// Logs which of the two happened and how long it took next to the cached build time.
+inline flat_bvh cached_flat_bvh(const char* path, const hittable_list& list, bvh_builder builder, threadPool* pool) {
+    flat_bvh bvh;
+    long build_ms = 0;
+    auto start = std::chrono::steady_clock::now();
+    if (load_bvh_cache(path, list, builder, bvh, build_ms)) {
+        auto load_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "BVH cache: loaded " << path << " in " << load_ms << "ms (building it took " << build_ms << "ms)" << std::endl;
+        return bvh;
+    }
+    bvh = build_flat_bvh(list, builder, pool);
+    build_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    if (save_bvh_cache(path, list, builder, bvh, build_ms)) {
+        std::cout << "BVH cache: built in " << build_ms << "ms, saved to " << path << std::endl;
+    } else {
+        std::cerr << "BVH cache: could not write " << path << std::endl;
+    }
+    return bvh;
+}
+
+#endif
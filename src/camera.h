@@ -7,26 +7,30 @@
 
 #include "common.h"
 
-class camera {
+// Camera with scalar type T, the renderer uses camera = camera_t<real>.
+template <typename T>
+class camera_t {
 private:
-    point3 origin;
-    point3 looking;
-    vec3 up;
-    point3 lower_left;
-    vec3 horizontal;
-    vec3 vertical;
-    vec3 u, v, w;
-    double lens_radius;
-    double view_height;
-    double view_width;
+    using vec = vec3_t<T>;
+
+    vec origin;
+    vec looking;
+    vec up;
+    vec lower_left;
+    vec horizontal;
+    vec vertical;
+    vec u, v, w;
+    T lens_radius;
+    T view_height;
+    T view_width;
 public:
-    camera(
-        point3 look_from,
-        point3 look_at,
-        vec3 vup,
-        double vfov, 
-        double aspect_ratio,
-        double aperture
+    camera_t(
+        vec look_from,
+        vec look_at,
+        vec vup,
+        T vfov, 
+        T aspect_ratio,
+        T aperture
     ) {
         auto theta = degrees_to_radians(vfov);
         auto h = tan(theta/2);
@@ -41,7 +45,7 @@ public:
         u = unit_vector(cross(up, w));
         v = cross(w, u);
 
-        double focus_dist = (look_from - look_at).length();
+        T focus_dist = (look_from - look_at).length();
         horizontal = focus_dist * view_width * u;
         vertical = focus_dist * view_height * v;
         lower_left = origin - horizontal/2 - vertical/2 - focus_dist * w;
@@ -50,24 +54,32 @@ public:
     }
 
     // origin is the camera position, each ray calculates a pixel of the view pane
-    ray get_ray(double s, double t) const {
-        vec3 rd = lens_radius * random_in_unit_disk();
-        vec3 offset = u * rd.x() + v * rd.y();
-        return ray(origin+offset, lower_left + s*horizontal + t*vertical - origin - offset);
+    // gen supplies the lens position, an rng or a path's sample_stream
+    template <typename G>
+    ray_t<T> get_ray(T s, T t, G& gen) const {
+        vec rd = lens_radius * vec(random_in_unit_disk(gen));
+        vec offset = u * rd.x() + v * rd.y();
+        return ray_t<T>(origin+offset, lower_left + s*horizontal + t*vertical - origin - offset);
+    }
+
+    ray_t<T> get_ray(T s, T t) const {
+        return get_ray(s, t, thread_rng());
     }
 
-    void move(vec3 vec) {
-        vec3 diff = vec.x() * u + vec.y() * v +  vec.z() * w;
+    void move(vec step) {
+        vec diff = step.x() * u + step.y() * v +  step.z() * w;
         origin += diff;
         w = unit_vector(origin - looking);
         u = unit_vector(cross(up, w));
         v = cross(w, u);
 
-        double focus_dist = (origin - looking).length();
+        T focus_dist = (origin - looking).length();
         horizontal = focus_dist * view_width * u;
         vertical = focus_dist * view_height * v;
         lower_left = origin - horizontal/2 - vertical/2 - focus_dist * w;
     }
 };
 
+using camera = camera_t<real>;
+
 #endif
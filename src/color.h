@@ -23,7 +23,7 @@ void write_color(std::ostream &out, color pixel_color, int samples) {
 		<< static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
 } 
 
-void write_color(uint8_t* render_pixels, double* pixel_avg, color& pixel_color, int& start, int& sample) {
+void write_color(uint8_t* render_pixels, real* pixel_avg, color& pixel_color, int& start, int& sample) {
     pixel_avg[start] += (pixel_color.x() - pixel_avg[start])/sample;
     pixel_avg[start+1] += (pixel_color.y() - pixel_avg[start+1])/sample;
     pixel_avg[start+2] += (pixel_color.z() - pixel_avg[start+2])/sample;
@@ -0,0 +1,262 @@
+#ifndef COMPRESSED_BVH_H
+#define COMPRESSED_BVH_H
+
+#include "wide_bvh.h"
+#include <cmath>
+#include <cstring>
+
+// Compressed 8-wide node (after Ylitie et al., "Efficient Incoherent Ray Traversal on GPUs Through
+// Compressed Wide BVHs"), 80 bytes instead of the 256 of wide_bvh_node<8>. Child boxes are stored
+// as 8-bit grid coordinates inside the node's own box: plane = origin + q * 2^exponent, with one
+// power of two exponent per axis so decoding is exact. Coordinates are rounded outwards, so the
+// decoded boxes always contain the real ones. Interior children are stored next to each other
+// starting at node_base, leaf children likewise in the leaves array starting at leaf_base, so
+// one index per kind replaces the eight child references.
+struct alignas(16) compressed_bvh8_node {
+    float origin[3];
+    uint32_t node_base;
+    uint32_t leaf_base;
+    int8_t exponent[3];
+    uint8_t interior_mask; // bit i set if slot i is an interior node
+    uint8_t leaf_mask;     // bit i set if slot i is a leaf
+    uint8_t axis[7];       // binary split axes in heap order, as in wide_bvh_node
+    uint8_t q_lo[3][8];
+    uint8_t q_hi[3][8];
+};
+
+static_assert(sizeof(compressed_bvh8_node) == 80, "compressed_bvh8_node must stay 80 bytes");
+
+// 2^e as a float, e within the normal range
+inline float exp2_float(int e) {
+    uint32_t bits = uint32_t(e + 127) << 23;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// scalar test of one ray against the 8 decoded child boxes, bit i of the result is set if child i is hit
+inline int intersect_compressed(const compressed_bvh8_node& node, const flat_ray& r, float t_min, float t_max) {
+    float t0[8], t1[8];
+    for (int i = 0; i < 8; i++) {
+        t0[i] = t_min;
+        t1[i] = t_max;
+    }
+    for (int a = 0; a < 3; a++) {
+        float scale = exp2_float(node.exponent[a]);
+        const uint8_t* near_q = r.dir_is_neg[a] ? node.q_hi[a] : node.q_lo[a];
+        const uint8_t* far_q = r.dir_is_neg[a] ? node.q_lo[a] : node.q_hi[a];
+        for (int i = 0; i < 8; i++) {
+            float near = (node.origin[a] + near_q[i] * scale - r.orig[a]) * r.inv_dir[a];
+            float far = (node.origin[a] + far_q[i] * scale - r.orig[a]) * r.inv_dir[a] * box_t_slack;
+            t0[i] = near > t0[i] ? near : t0[i];
+            t1[i] = far < t1[i] ? far : t1[i];
+        }
+    }
+    int mask = 0;
+    for (int i = 0; i < 8; i++) {
+        if (t0[i] <= t1[i]) mask |= 1 << i;
+    }
+    return mask & (node.interior_mask | node.leaf_mask);
+}
+
+#if defined(RAY_X86)
+// decodes and tests all 8 children at once, only called after cpu_has_avx2() said yes
+RAY_TARGET_AVX2
+inline int intersect_compressed_avx2(const compressed_bvh8_node& node, const flat_ray& r, float t_min, float t_max) {
+    __m256 t0 = _mm256_set1_ps(t_min);
+    __m256 t1 = _mm256_set1_ps(t_max);
+    const __m256 slack = _mm256_set1_ps(box_t_slack);
+    for (int a = 0; a < 3; a++) {
+        __m256 scale = _mm256_set1_ps(exp2_float(node.exponent[a]));
+        __m256 origin = _mm256_set1_ps(node.origin[a]);
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(node.q_lo[a]))));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(node.q_hi[a]))));
+        // q * 2^e is exact, so the fused origin + q * scale rounds the same as the builder's check
+        lo = _mm256_fmadd_ps(lo, scale, origin);
+        hi = _mm256_fmadd_ps(hi, scale, origin);
+        __m256 orig = _mm256_set1_ps(r.orig[a]);
+        __m256 inv_dir = _mm256_set1_ps(r.inv_dir[a]);
+        __m256 near = _mm256_mul_ps(_mm256_sub_ps(r.dir_is_neg[a] ? hi : lo, orig), inv_dir);
+        __m256 far = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(r.dir_is_neg[a] ? lo : hi, orig), inv_dir), slack);
+        t0 = _mm256_max_ps(near, t0);
+        t1 = _mm256_min_ps(far, t1);
+    }
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)) & (node.interior_mask | node.leaf_mask);
+}
+#endif
+
+// 8-wide bvh with compressed_bvh8_node nodes, made from a built bvh8. A memory trade-off: nodes
+// plus leaf references take 2.8x less memory than bvh8's nodes, but decoding the child boxes
+// costs about what the smaller fetches save, so it traces within a few percent of bvh8 either way.
+class compressed_bvh8 : public accelerator {
+public:
+    std::vector<compressed_bvh8_node, aligned_allocator<compressed_bvh8_node, 64>> nodes;
+    std::vector<uint32_t> leaves; // wide_leaf() references
+    std::vector<shared_ptr<hittable>> primitives;
+    sphere_soa leaf_spheres; // see flat_bvh::leaf_spheres
+    std::vector<primitive> leaf_closed;
+    aabb box;
+
+    compressed_bvh8() = default;
+    compressed_bvh8(const bvh8& wide) : primitives(wide.primitives), leaf_spheres(wide.leaf_spheres), leaf_closed(wide.leaf_closed), box(wide.box) {
+        if (wide.nodes.empty()) return;
+        nodes.resize(1);
+        nodes.reserve(wide.nodes.size());
+        compress(wide, 0, 0);
+    }
+
+    size_t node_count() const override { return nodes.size(); }
+    size_t node_bytes() const override { return nodes.size() * sizeof(compressed_bvh8_node) + leaves.size() * sizeof(uint32_t); }
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    bool occluded(const ray& r, double t_min, double t_max) const override;
+
+    bool bounding_box(aabb& output_box) const override {
+        if (nodes.empty()) return false;
+        output_box = box;
+        return true;
+    }
+
+    // same traversal as wide_bvh::traverse, stack entries are node indices or wide_leaf() references
+    template <int (*Intersect)(const compressed_bvh8_node&, const flat_ray&, float, float), bool AnyHit>
+    bool traverse(const ray& r, double t_min, double t_max, hit_record* rec) const {
+        if (nodes.empty()) return false;
+
+        flat_ray fr(r);
+        bool hit_anything = false;
+        auto closest_so_far = t_max;
+
+        uint32_t stack[max_bvh_depth * 8];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            uint32_t current = stack[--stack_size];
+            if (wide_is_leaf(current)) {
+                if (intersect_leaf<AnyHit>(primitives, leaf_spheres, leaf_closed, wide_leaf_offset(current), wide_leaf_count(current),
+                                           r, t_min, t_max, closest_so_far, rec)) {
+                    if (AnyHit) return true;
+                    hit_anything = true;
+                }
+                continue;
+            }
+
+            const compressed_bvh8_node& node = nodes[current];
+            int mask = Intersect(node, fr, static_cast<float>(t_min), static_cast<float>(closest_so_far));
+            if (mask == 0) continue;
+
+            // push far-to-near so the nearest child is popped first
+            int order[8];
+            wide_child_order<8>(node.axis, fr, order);
+            for (int i = 7; i >= 0; i--) {
+                int s = order[i];
+                if (!(mask & (1 << s))) continue;
+                uint32_t below = (1u << s) - 1;
+                if (node.interior_mask & (1 << s)) stack[stack_size++] = node.node_base + __builtin_popcount(node.interior_mask & below);
+                else stack[stack_size++] = leaves[node.leaf_base + __builtin_popcount(node.leaf_mask & below)];
+            }
+        }
+
+        return hit_anything;
+    }
+
+private:
+    // Fills nodes[out] from wide node w, then reserves one contiguous block for its interior
+    // children and fills those. Indices only, the recursion reallocates nodes.
+    void compress(const bvh8& wide, uint32_t w, uint32_t out) {
+        const wide_bvh_node<8>& src = wide.nodes[w];
+        compressed_bvh8_node node;
+        memset(&node, 0, sizeof(node));
+        for (int i = 0; i < 7; i++) node.axis[i] = src.axis[i];
+
+        uint32_t interior[8];
+        int n_interior = 0;
+        node.leaf_base = static_cast<uint32_t>(leaves.size());
+        for (int i = 0; i < 8; i++) {
+            uint32_t child = src.child[i];
+            if (child == wide_empty_child) continue;
+            if (wide_is_leaf(child)) {
+                node.leaf_mask |= 1 << i;
+                leaves.push_back(child);
+            } else {
+                node.interior_mask |= 1 << i;
+                interior[n_interior++] = child;
+            }
+        }
+
+        for (int a = 0; a < 3; a++) quantize_axis(src, a, node);
+
+        node.node_base = static_cast<uint32_t>(nodes.size());
+        nodes.resize(nodes.size() + n_interior);
+        nodes[out] = node;
+        for (int i = 0; i < n_interior; i++) compress(wide, interior[i], node.node_base + i);
+    }
+
+    // Picks the smallest exponent whose 255 steps from the lowest child plane reach the highest,
+    // then rounds every child plane outwards, checked with the same float math the kernels decode with.
+    static void quantize_axis(const wide_bvh_node<8>& src, int a, compressed_bvh8_node& node) {
+        int occupied = node.interior_mask | node.leaf_mask;
+        float lo = std::numeric_limits<float>::infinity(), hi = -std::numeric_limits<float>::infinity();
+        for (int i = 0; i < 8; i++) {
+            if (!(occupied & (1 << i))) continue;
+            lo = fmin(lo, src.bounds[0][a][i]);
+            hi = fmax(hi, src.bounds[1][a][i]);
+        }
+        if (!(lo <= hi)) lo = hi = 0;
+
+        int e = -100;
+        if (hi > lo) {
+            frexp((hi - lo) / 255.0, &e);
+            e = e < -100 ? -100 : e - 1;
+        }
+        while (e < 100 && lo + 255 * exp2_float(e) < hi) e++;
+        float scale = exp2_float(e);
+        node.origin[a] = lo;
+        node.exponent[a] = static_cast<int8_t>(e);
+
+        for (int i = 0; i < 8; i++) {
+            if (!(occupied & (1 << i))) {
+                // empty slot, never hit anyway because of the occupied mask
+                node.q_lo[a][i] = 255;
+                node.q_hi[a][i] = 0;
+                continue;
+            }
+            float c_lo = src.bounds[0][a][i], c_hi = src.bounds[1][a][i];
+            int q_lo = static_cast<int>(std::floor((c_lo - lo) / scale));
+            q_lo = q_lo < 0 ? 0 : (q_lo > 255 ? 255 : q_lo);
+            while (q_lo > 0 && lo + q_lo * scale > c_lo) q_lo--;
+            int q_hi = static_cast<int>(std::ceil((c_hi - lo) / scale));
+            q_hi = q_hi < 0 ? 0 : (q_hi > 255 ? 255 : q_hi);
+            while (q_hi < 255 && lo + q_hi * scale < c_hi) q_hi++;
+            node.q_lo[a][i] = static_cast<uint8_t>(q_lo);
+            node.q_hi[a][i] = static_cast<uint8_t>(q_hi);
+        }
+    }
+};
+
+#if defined(RAY_X86)
+RAY_TARGET_AVX2 __attribute__((flatten))
+inline bool compressed_bvh8_hit_avx2(const compressed_bvh8& bvh, const ray& r, double t_min, double t_max, hit_record& rec) {
+    return bvh.traverse<intersect_compressed_avx2, false>(r, t_min, t_max, &rec);
+}
+
+RAY_TARGET_AVX2 __attribute__((flatten))
+inline bool compressed_bvh8_occluded_avx2(const compressed_bvh8& bvh, const ray& r, double t_min, double t_max) {
+    return bvh.traverse<intersect_compressed_avx2, true>(r, t_min, t_max, nullptr);
+}
+#endif
+
+inline bool compressed_bvh8::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+#if defined(RAY_X86)
+    if (cpu_has_avx2()) return compressed_bvh8_hit_avx2(*this, r, t_min, t_max, rec);
+#endif
+    return traverse<intersect_compressed, false>(r, t_min, t_max, &rec);
+}
+
+inline bool compressed_bvh8::occluded(const ray& r, double t_min, double t_max) const {
+#if defined(RAY_X86)
+    if (cpu_has_avx2()) return compressed_bvh8_occluded_avx2(*this, r, t_min, t_max);
+#endif
+    return traverse<intersect_compressed, true>(r, t_min, t_max, nullptr);
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef DYNAMIC_BVH_H
+#define DYNAMIC_BVH_H
+
+#include "accel.h"
+
+// once refitting has made the tree this much more expensive than right after its last build, rebuild it
+const double refit_rebuild_ratio = 1.3;
+
+// BVH for scenes whose objects move between frames but keep existing (e.g. spheres moved with
+// sphere::update). update() refits the boxes of the current tree instead of building a new one
+// and falls back to a full rebuild once the refit tree's SAH cost has degraded too far. The wide
+// nodes are refit in place from the binary boxes, only a rebuild collapses the tree again.
+class dynamic_bvh : public accelerator {
+public:
+    dynamic_bvh(const hittable_list& list, bvh_kernel kernel, bvh_builder builder = bvh_builder::lbvh, threadPool* pool = nullptr,
+                bvh_node_layout layout = bvh_node_layout::depth_first)
+        : objects(list), kernel(kernel), builder(builder), pool(pool), layout(layout) {
+        rebuild();
+    }
+
+    // call after moving objects, returns true if the tree had to be rebuilt
+    bool update() {
+        binary.refit(pool);
+        if (binary.sah_cost() > refit_rebuild_ratio * built_cost) {
+            rebuild();
+            return true;
+        }
+        switch (kernel) {
+            case bvh_kernel::avx2_8wide: wide8.refit(binary, pool); break;
+            case bvh_kernel::sse_4wide: wide4.refit(binary, pool); break;
+            default: break;
+        }
+        return false;
+    }
+
+    double sah_cost() const { return binary.sah_cost(); }
+    size_t node_count() const override { return traversal().node_count(); }
+    size_t node_bytes() const override { return traversal().node_bytes(); }
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        return traversal().hit(r, t_min, t_max, rec);
+    }
+
+    bool occluded(const ray& r, double t_min, double t_max) const override {
+        return traversal().occluded(r, t_min, t_max);
+    }
+
+    void hit_packet(const ray_packet& packet, double t_min, double t_max, hit_record recs[], bool hits[]) const override {
+        traversal().hit_packet(packet, t_min, t_max, recs, hits);
+    }
+
+    bool bounding_box(aabb& output_box) const override {
+        return binary.bounding_box(output_box);
+    }
+
+private:
+    hittable_list objects;
+    bvh_kernel kernel;
+    bvh_builder builder;
+    threadPool* pool;
+    bvh_node_layout layout;
+    flat_bvh binary;
+    bvh8 wide8; // the tree traversed for the 8-wide kernel
+    bvh4 wide4; // and for the 4-wide one
+    double built_cost = 0;
+
+    const accelerator& traversal() const {
+        switch (kernel) {
+            case bvh_kernel::avx2_8wide: return wide8;
+            case bvh_kernel::sse_4wide: return wide4;
+            default: return binary;
+        }
+    }
+
+    void rebuild() {
+        binary = build_flat_bvh(objects, builder, pool);
+        built_cost = binary.sah_cost();
+        collapse();
+    }
+
+    // wide nodes keep the binary node of each child slot, so update() can refit them (in any layout)
+    void collapse() {
+        bool treelets = layout == bvh_node_layout::treelets;
+        switch (kernel) {
+            case bvh_kernel::avx2_8wide:
+                wide8 = bvh8(binary, true);
+                if (treelets) wide8.reorder_treelets();
+                break;
+            case bvh_kernel::sse_4wide:
+                wide4 = bvh4(binary, true);
+                if (treelets) wide4.reorder_treelets();
+                break;
+            default: break;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,465 @@
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include "bvh.h"
+#include "sphere_soa.h"
+#include "primitive.h"
+#include "aligned.h"
+#include "threadpool.h"
+#include <cstdint>
+
+// largest number of primitives the builder will put in one leaf
+const int max_prims_in_leaf = 4;
+// traversal stack size, the builder falls back to median splits so the tree never gets deeper than this
+const int max_bvh_depth = 64;
+
+// round a double to the nearest float that is below (above) it, so float boxes always contain the double box
+inline float float_down(double x) {
+    float f = static_cast<float>(x);
+    return f > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+inline float float_up(double x) {
+    float f = static_cast<float>(x);
+    return f < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+// ray prepared once per traversal for float slab tests against node boxes
+struct flat_ray {
+    float orig[3];
+    float inv_dir[3];
+    int dir_is_neg[3];
+
+    flat_ray(const ray& r) {
+        for (int a = 0; a < 3; a++) {
+            orig[a] = static_cast<float>(r.origin()[a]);
+            inv_dir[a] = static_cast<float>(1.0 / r.direction()[a]);
+            dir_is_neg[a] = inv_dir[a] < 0;
+        }
+    }
+};
+
+// float rounding in the slab test can push the far hit just below the true value,
+// so t_max of the box is widened by a few ulps to never miss a grazing hit
+const float box_t_slack = 1.0f + 4*std::numeric_limits<float>::epsilon();
+
+// The rays of a packet prepared like flat_ray, plus the range of their origins and inverse
+// directions. Interval arithmetic over those ranges bounds the entry and exit distances of all
+// rays at once, which makes may_hit() a test of the packet's frustum: a box it rejects is missed
+// by every ray of the packet.
+struct packet_frustum {
+    alignas(32) float orig[3][packet_size];
+    alignas(32) float inv_dir[3][packet_size];
+    float orig_lo[3], orig_hi[3];
+    float inv_lo[3], inv_hi[3];
+    int dir_is_neg[3];
+    bool coherent; // every ray has the same dir_is_neg, needed by may_hit() and for one child order
+
+    packet_frustum(const ray_packet& packet) : coherent(packet.count > 0) {
+        for (int i = 0; i < packet.count; i++) {
+            flat_ray fr(packet.rays[i]);
+            for (int a = 0; a < 3; a++) {
+                orig[a][i] = fr.orig[a];
+                inv_dir[a][i] = fr.inv_dir[a];
+            }
+            if (i == 0) {
+                for (int a = 0; a < 3; a++) dir_is_neg[a] = fr.dir_is_neg[a];
+            } else {
+                for (int a = 0; a < 3; a++) coherent = coherent && dir_is_neg[a] == fr.dir_is_neg[a];
+            }
+        }
+        for (int a = 0; a < 3; a++) {
+            orig_lo[a] = inv_lo[a] = std::numeric_limits<float>::infinity();
+            orig_hi[a] = inv_hi[a] = -std::numeric_limits<float>::infinity();
+            for (int i = 0; i < packet.count; i++) {
+                orig_lo[a] = orig[a][i] < orig_lo[a] ? orig[a][i] : orig_lo[a];
+                orig_hi[a] = orig[a][i] > orig_hi[a] ? orig[a][i] : orig_hi[a];
+                inv_lo[a] = inv_dir[a][i] < inv_lo[a] ? inv_dir[a][i] : inv_lo[a];
+                inv_hi[a] = inv_dir[a][i] > inv_hi[a] ? inv_dir[a][i] : inv_hi[a];
+            }
+        }
+    }
+
+    // false only if no ray of a coherent packet can hit the box in [t_min, t_max]
+    bool may_hit(const float bounds_min[3], const float bounds_max[3], float t_min, float t_max) const {
+        for (int a = 0; a < 3; a++) {
+            float near = dir_is_neg[a] ? bounds_max[a] : bounds_min[a];
+            float far = dir_is_neg[a] ? bounds_min[a] : bounds_max[a];
+            // (plane - orig) * inv_dir over all origins and directions, extreme at the interval ends
+            float n0 = (near - orig_lo[a]) * inv_lo[a], n1 = (near - orig_lo[a]) * inv_hi[a];
+            float n2 = (near - orig_hi[a]) * inv_lo[a], n3 = (near - orig_hi[a]) * inv_hi[a];
+            float f0 = (far - orig_lo[a]) * inv_lo[a], f1 = (far - orig_lo[a]) * inv_hi[a];
+            float f2 = (far - orig_hi[a]) * inv_lo[a], f3 = (far - orig_hi[a]) * inv_hi[a];
+            float t0 = fmin(fmin(n0, n1), fmin(n2, n3));
+            float t1 = fmax(fmax(f0, f1), fmax(f2, f3));
+            // widened both ways, the bounds round differently than the per ray tests
+            t0 -= fabs(t0) * (box_t_slack - 1);
+            t1 += fabs(t1) * (box_t_slack - 1);
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max < t_min) return false;
+        }
+        return true;
+    }
+
+    // The rays of active whose own slab test (the same as flat_bvh_node::hit) passes, ray i tested
+    // against [t_min, t_max[i]]. With first_only it stops at the first ray that hits and returns it
+    // together with all active rays after it, untested.
+    uint64_t hit_mask(const float bounds_min[3], const float bounds_max[3], float t_min, const float t_max[],
+                      uint64_t active, bool first_only) const;
+
+private:
+    uint64_t hit_mask_scalar(const float bounds_min[3], const float bounds_max[3], float t_min, const float t_max[],
+                             uint64_t active, bool first_only) const {
+        uint64_t mask = 0;
+        for (uint64_t m = active; m; m &= m - 1) {
+            int i = __builtin_ctzll(m);
+            float t0 = t_min, t1 = t_max[i];
+            for (int a = 0; a < 3; a++) {
+                float near = ((dir_is_neg[a] ? bounds_max[a] : bounds_min[a]) - orig[a][i]) * inv_dir[a][i];
+                float far = ((dir_is_neg[a] ? bounds_min[a] : bounds_max[a]) - orig[a][i]) * inv_dir[a][i];
+                far *= box_t_slack;
+                t0 = near > t0 ? near : t0;
+                t1 = far < t1 ? far : t1;
+            }
+            if (t0 <= t1) {
+                if (first_only) return m;
+                mask |= m & (0 - m);
+            }
+        }
+        return mask;
+    }
+
+#if defined(RAY_X86)
+    RAY_TARGET_AVX2
+    uint64_t hit_mask_avx2(const float bounds_min[3], const float bounds_max[3], float t_min, const float t_max[],
+                           uint64_t active, bool first_only) const {
+        uint64_t mask = 0;
+        const __m256 slack = _mm256_set1_ps(box_t_slack);
+        for (int g = 0; g < packet_size / 8; g++) {
+            int lanes = static_cast<int>((active >> (8*g)) & 0xFF);
+            if (lanes == 0) continue;
+            __m256 t0 = _mm256_set1_ps(t_min);
+            __m256 t1 = _mm256_loadu_ps(t_max + 8*g);
+            for (int a = 0; a < 3; a++) {
+                __m256 o = _mm256_load_ps(orig[a] + 8*g);
+                __m256 inv = _mm256_load_ps(inv_dir[a] + 8*g);
+                __m256 near = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(dir_is_neg[a] ? bounds_max[a] : bounds_min[a]), o), inv);
+                __m256 far = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(dir_is_neg[a] ? bounds_min[a] : bounds_max[a]), o), inv);
+                far = _mm256_mul_ps(far, slack);
+                t0 = _mm256_max_ps(near, t0);
+                t1 = _mm256_min_ps(far, t1);
+            }
+            int hit = _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)) & lanes;
+            if (hit == 0) continue;
+            if (first_only) return active & ~((uint64_t(1) << (8*g + __builtin_ctz(hit))) - 1);
+            mask |= uint64_t(hit) << (8*g);
+        }
+        return mask;
+    }
+#endif
+};
+
+inline uint64_t packet_frustum::hit_mask(const float bounds_min[3], const float bounds_max[3], float t_min, const float t_max[],
+                                         uint64_t active, bool first_only) const {
+#if defined(RAY_X86)
+    if (cpu_has_avx2()) return hit_mask_avx2(bounds_min, bounds_max, t_min, t_max, active, first_only);
+#endif
+    return hit_mask_scalar(bounds_min, bounds_max, t_min, t_max, active, first_only);
+}
+
+// One node of the flattened tree, exactly 32 bytes so two nodes share a cache line.
+// Interior nodes store their left child right after themselves (depth-first order),
+// so only the offset of the second child is needed.
+struct flat_bvh_node {
+    float bounds_min[3];
+    float bounds_max[3];
+    union {
+        int32_t primitives_offset;   // leaf
+        int32_t second_child_offset; // interior
+    };
+    uint16_t n_primitives;           // 0 for interior nodes
+    uint8_t axis;                    // split axis, decides which child is visited first
+    uint8_t pad;
+
+    void set_bounds(const aabb& box) {
+        for (int a = 0; a < 3; a++) {
+            bounds_min[a] = float_down(box.min()[a]);
+            bounds_max[a] = float_up(box.max()[a]);
+        }
+    }
+
+    void set_bounds(const flat_bvh_node& a, const flat_bvh_node& b) {
+        for (int i = 0; i < 3; i++) {
+            bounds_min[i] = a.bounds_min[i] < b.bounds_min[i] ? a.bounds_min[i] : b.bounds_min[i];
+            bounds_max[i] = a.bounds_max[i] > b.bounds_max[i] ? a.bounds_max[i] : b.bounds_max[i];
+        }
+    }
+
+    double surface_area() const {
+        double dx = bounds_max[0] - bounds_min[0], dy = bounds_max[1] - bounds_min[1], dz = bounds_max[2] - bounds_min[2];
+        return 2.0 * (dx*dy + dy*dz + dz*dx);
+    }
+
+    bool hit(const flat_ray& r, float t_min, float t_max) const {
+        for (int a = 0; a < 3; a++) {
+            float t0 = ((r.dir_is_neg[a] ? bounds_max[a] : bounds_min[a]) - r.orig[a]) * r.inv_dir[a];
+            float t1 = ((r.dir_is_neg[a] ? bounds_min[a] : bounds_max[a]) - r.orig[a]) * r.inv_dir[a];
+            t1 *= box_t_slack;
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max < t_min) return false;
+        }
+        return true;
+    }
+};
+
+static_assert(sizeof(flat_bvh_node) == 32, "flat_bvh_node must stay 32 bytes");
+
+// Intersects primitives [offset, offset + count) of a bvh leaf, through spheres or closed when the
+// bvh packed its primitives into one of them (see flat_bvh::pack_leaves). The closest hit goes into
+// rec and lowers closest_so_far, with AnyHit it returns at the first primitive occluding the ray.
+template <bool AnyHit>
+inline bool intersect_leaf(const std::vector<shared_ptr<hittable>>& primitives, const sphere_soa& spheres,
+                           const std::vector<primitive>& closed, int offset, int count,
+                           const ray& r, double t_min, double t_max, double& closest_so_far, hit_record* rec) {
+    if (!spheres.empty()) {
+        if (AnyHit) return spheres.occluded_range(r, offset, offset + count, t_min, t_max);
+        return spheres.hit_range(r, offset, offset + count, t_min, closest_so_far, *rec);
+    }
+    bool hit_anything = false;
+    if (!closed.empty()) {
+        for (int i = offset; i < offset + count; i++) {
+            if (AnyHit) {
+                if (primitive_occludes(closed[i], r, t_min, t_max)) return true;
+            } else if (hit_primitive(closed[i], r, t_min, closest_so_far, *rec)) {
+                hit_anything = true;
+                closest_so_far = rec->t;
+            }
+        }
+        return hit_anything;
+    }
+    for (int i = 0; i < count; i++) {
+        const hittable& object = *primitives[offset + i];
+        if (AnyHit) {
+            if (object.occluded(r, t_min, t_max)) return true;
+        } else if (object.hit(r, t_min, closest_so_far, *rec)) {
+            hit_anything = true;
+            closest_so_far = rec->t;
+        }
+    }
+    return hit_anything;
+}
+
+// SAH bvh stored as one contiguous array of nodes with child offsets instead of pointers
+class flat_bvh : public accelerator {
+public:
+    std::vector<flat_bvh_node, aligned_allocator<flat_bvh_node, 64>> nodes;
+    std::vector<shared_ptr<hittable>> primitives; // in leaf order
+    // Copies of primitives in the same order, used by the leaves instead of one virtual call per
+    // primitive. leaf_spheres when all of them are spheres (intersected a SIMD block at a time),
+    // otherwise leaf_closed when all of them are in the closed primitive set. Both are empty if
+    // any primitive is a custom hittable.
+    sphere_soa leaf_spheres;
+    std::vector<primitive> leaf_closed;
+
+    flat_bvh() = default;
+    flat_bvh(const hittable_list& list) {
+        auto prims = make_bvh_primitives(list.get_objects());
+        if (prims.empty()) return;
+        nodes.reserve(2 * prims.size());
+        primitives.reserve(prims.size());
+        build(prims, 0, prims.size(), 0);
+        pack_leaves();
+    }
+
+    // called by the builders once primitives is in its final order
+    void pack_leaves() {
+        leaf_spheres.clear();
+        leaf_closed.clear();
+        bool all_spheres = true;
+        for (const auto& object : primitives) {
+            if (!is_closed_primitive(*object)) return;
+            all_spheres = all_spheres && typeid(*object) == typeid(sphere);
+        }
+        if (all_spheres) {
+            leaf_spheres.reserve(primitives.size());
+            for (const auto& object : primitives) leaf_spheres.add(static_cast<const sphere&>(*object));
+        } else {
+            leaf_closed.resize(primitives.size());
+            for (size_t i = 0; i < primitives.size(); i++) to_primitive(*primitives[i], leaf_closed[i]);
+        }
+    }
+
+    size_t node_count() const override { return nodes.size(); }
+    size_t node_bytes() const override { return nodes.size() * sizeof(flat_bvh_node); }
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        return traverse<false>(r, t_min, t_max, &rec);
+    }
+
+    bool occluded(const ray& r, double t_min, double t_max) const override {
+        return traverse<true>(r, t_min, t_max, nullptr);
+    }
+
+    // closest hit into rec, or with AnyHit return at the first primitive that occludes the ray
+    template <bool AnyHit>
+    bool traverse(const ray& r, double t_min, double t_max, hit_record* rec) const {
+        if (nodes.empty()) return false;
+
+        flat_ray fr(r);
+        bool hit_anything = false;
+        auto closest_so_far = t_max;
+
+        int stack[max_bvh_depth];
+        int stack_size = 0;
+        int current = 0;
+        while (true) {
+            const flat_bvh_node& node = nodes[current];
+            if (node.hit(fr, static_cast<float>(t_min), static_cast<float>(closest_so_far))) {
+                if (node.n_primitives > 0) {
+                    if (intersect_leaf<AnyHit>(primitives, leaf_spheres, leaf_closed, node.primitives_offset, node.n_primitives,
+                                               r, t_min, t_max, closest_so_far, rec)) {
+                        if (AnyHit) return true;
+                        hit_anything = true;
+                    }
+                    if (stack_size == 0) break;
+                    current = stack[--stack_size];
+                } else if (fr.dir_is_neg[node.axis]) {
+                    // visit the child closer to the ray origin first so closest_so_far shrinks early
+                    stack[stack_size++] = current + 1;
+                    current = node.second_child_offset;
+                } else {
+                    stack[stack_size++] = node.second_child_offset;
+                    current = current + 1;
+                }
+            } else {
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+        }
+
+        return hit_anything;
+    }
+
+    bool bounding_box(aabb& output_box) const override {
+        if (nodes.empty()) return false;
+        const flat_bvh_node& root = nodes[0];
+        output_box = aabb(point3(root.bounds_min[0], root.bounds_min[1], root.bounds_min[2]),
+                          point3(root.bounds_max[0], root.bounds_max[1], root.bounds_max[2]));
+        return true;
+    }
+
+    // Recomputes every box bottom-up after primitives moved, keeping the tree topology.
+    // In depth-first order a subtree is a contiguous index range and children come after their
+    // parent, so the subtrees below the top levels are refit in parallel by walking their ranges
+    // backwards, then the few top nodes are refit on this thread.
+    void refit(threadPool* pool = nullptr) {
+        if (nodes.empty()) return;
+        int levels = 0;
+        if (pool) while ((1 << levels) < 4 * pool->size()) levels++;
+
+        std::vector<int> top, roots;
+        collect_subtrees(0, 0, levels, top, roots);
+        parallel_chunks(pool, 0, roots.size(), pool ? pool->size() : 1, [&](int, size_t cs, size_t ce) {
+            for (size_t i = cs; i < ce; i++) refit_range(roots[i], subtree_end(roots[i]));
+        });
+        for (auto it = top.rbegin(); it != top.rend(); ++it) refit_node(*it);
+    }
+
+    // expected cost of a ray that hits the root, in primitive intersections (same model as the builders)
+    double sah_cost() const {
+        if (nodes.empty()) return 0;
+        double cost = 0;
+        for (const auto& node : nodes) {
+            cost += node.surface_area() * (node.n_primitives > 0 ? node.n_primitives : sah_traversal_cost);
+        }
+        double root_area = nodes[0].surface_area();
+        return root_area > 0 ? cost / root_area : cost;
+    }
+
+private:
+    // one past the last node of the subtree rooted at i, found by following second children to a leaf
+    int subtree_end(int i) const {
+        while (nodes[i].n_primitives == 0) i = nodes[i].second_child_offset;
+        return i + 1;
+    }
+
+    void collect_subtrees(int i, int depth, int levels, std::vector<int>& top, std::vector<int>& roots) const {
+        if (depth == levels || nodes[i].n_primitives > 0) {
+            roots.push_back(i);
+            return;
+        }
+        top.push_back(i);
+        collect_subtrees(i + 1, depth + 1, levels, top, roots);
+        collect_subtrees(nodes[i].second_child_offset, depth + 1, levels, top, roots);
+    }
+
+    void refit_range(int begin, int end) {
+        for (int i = end - 1; i >= begin; i--) refit_node(i);
+    }
+
+    void refit_node(int i) {
+        flat_bvh_node& node = nodes[i];
+        if (node.n_primitives == 0) {
+            node.set_bounds(nodes[i + 1], nodes[node.second_child_offset]);
+            return;
+        }
+        aabb box, temp_box;
+        for (int p = 0; p < node.n_primitives; p++) {
+            int i = node.primitives_offset + p;
+            primitives[i]->bounding_box(temp_box);
+            box = surrounding_box(box, temp_box);
+            if (!leaf_spheres.empty()) {
+                const sphere& s = static_cast<const sphere&>(*primitives[i]);
+                leaf_spheres.set(i, s.center, s.rad);
+            } else if (!leaf_closed.empty()) {
+                to_primitive(*primitives[i], leaf_closed[i]);
+            }
+        }
+        node.set_bounds(box);
+    }
+
+    // emits the subtree over prims[start, end) in depth-first order and returns its node index
+    int build(std::vector<bvh_primitive>& prims, size_t start, size_t end, int depth) {
+        int index = static_cast<int>(nodes.size());
+        nodes.emplace_back();
+
+        aabb box;
+        for (size_t i = start; i < end; i++) box = surrounding_box(box, prims[i].box);
+
+        size_t n = end - start;
+        int axis = 0;
+        double split_cost = infinity;
+        size_t mid = start + n/2;
+        if (n > 1) {
+            if (depth < max_bvh_depth/2) {
+                mid = sah_split(prims, start, end, axis, split_cost);
+            } else {
+                // degenerate input (e.g. many identical centroids), median split bounds the remaining depth
+                aabb centroids;
+                for (size_t i = start; i < end; i++) centroids = surrounding_box(centroids, aabb(prims[i].centroid, prims[i].centroid));
+                axis = centroids.longest_axis();
+                std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+                    [axis](const bvh_primitive& a, const bvh_primitive& b) { return a.centroid[axis] < b.centroid[axis]; });
+            }
+        }
+
+        if (n == 1 || (n <= max_prims_in_leaf && n <= split_cost)) {
+            nodes[index].primitives_offset = static_cast<int32_t>(primitives.size());
+            nodes[index].n_primitives = static_cast<uint16_t>(n);
+            for (size_t i = start; i < end; i++) primitives.push_back(prims[i].object);
+        } else {
+            nodes[index].n_primitives = 0;
+            nodes[index].axis = static_cast<uint8_t>(axis);
+            build(prims, start, mid, depth + 1);
+            int second = build(prims, mid, end, depth + 1);
+            nodes[index].second_child_offset = second;
+        }
+        nodes[index].pad = 0;
+        nodes[index].set_bounds(box);
+        return index;
+    }
+};
+
+#endif
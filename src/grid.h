@@ -0,0 +1,202 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include "bvh.h"
+#include <cstdint>
+
+// objects larger than this many times the median object extent are kept out of the grid
+const double grid_large_object_ratio = 16.0;
+// upper bound on cells per axis, keeps memory bounded for very spread out scenes
+const int grid_max_resolution = 256;
+
+// Uniform grid traversed with 3D-DDA (Amanatides & Woo). Works best when objects are many and
+// of similar size, like the small spheres of random_scene(). Objects much bigger than the rest
+// (e.g. the ground sphere) would land in every cell, so they are tested separately per ray, as
+// are objects with no bounding box at all (e.g. a plane).
+class grid_accel : public accelerator {
+public:
+    std::vector<shared_ptr<hittable>> primitives;
+    std::vector<shared_ptr<hittable>> large_objects;
+    std::vector<uint32_t> cell_start;   // cell i holds cell_objects[cell_start[i], cell_start[i+1])
+    std::vector<uint32_t> cell_objects; // indices into primitives
+    aabb bounds;
+    int res[3];
+    vec3 cell_size;
+
+    // density is the target number of cells per object
+    grid_accel(const hittable_list& list, double density = 2.0) {
+        auto prims = make_bvh_primitives(list.get_objects(), &large_objects);
+        res[0] = res[1] = res[2] = 1;
+        if (prims.empty()) return;
+
+        // split off the objects that are far bigger than the typical one
+        std::vector<double> extents;
+        for (const auto& prim : prims) extents.push_back(max_extent(prim.box));
+        std::nth_element(extents.begin(), extents.begin() + extents.size()/2, extents.end());
+        double large = grid_large_object_ratio * extents[extents.size()/2];
+
+        std::vector<aabb> boxes;
+        for (const auto& prim : prims) {
+            if (max_extent(prim.box) > large) {
+                large_objects.push_back(prim.object);
+            } else {
+                primitives.push_back(prim.object);
+                boxes.push_back(prim.box);
+                bounds = surrounding_box(bounds, prim.box);
+            }
+        }
+        if (primitives.empty()) return;
+
+        choose_resolution(density);
+
+        // two passes: count objects per cell, then fill the compacted cell lists
+        std::vector<uint32_t> counts(cell_count() + 1, 0);
+        for (const auto& box : boxes) for_each_cell(box, [&](int cell) { counts[cell]++; });
+        cell_start.assign(cell_count() + 1, 0);
+        for (int i = 0; i < cell_count(); i++) cell_start[i+1] = cell_start[i] + counts[i];
+        cell_objects.resize(cell_start.back());
+        std::vector<uint32_t> fill(cell_start.begin(), cell_start.end() - 1);
+        for (size_t i = 0; i < boxes.size(); i++)
+            for_each_cell(boxes[i], [&](int cell) { cell_objects[fill[cell]++] = static_cast<uint32_t>(i); });
+    }
+
+    int cell_count() const { return res[0] * res[1] * res[2]; }
+    size_t node_count() const override { return cell_start.empty() ? 0 : cell_count(); }
+    size_t node_bytes() const override {
+        return cell_start.size() * sizeof(uint32_t) + cell_objects.size() * sizeof(uint32_t);
+    }
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        return traverse<false>(r, t_min, t_max, &rec);
+    }
+
+    bool occluded(const ray& r, double t_min, double t_max) const override {
+        return traverse<true>(r, t_min, t_max, nullptr);
+    }
+
+    // closest hit into rec, or with AnyHit return at the first object that occludes the ray
+    template <bool AnyHit>
+    bool traverse(const ray& r, double t_min, double t_max, hit_record* rec) const {
+        bool hit_anything = false;
+        auto closest_so_far = t_max;
+
+        for (const auto& object : large_objects) {
+            if (AnyHit) {
+                if (object->occluded(r, t_min, t_max)) return true;
+            } else if (object->hit(r, t_min, closest_so_far, *rec)) {
+                hit_anything = true;
+                closest_so_far = rec->t;
+            }
+        }
+        if (cell_start.empty()) return hit_anything;
+
+        // clip the ray against the grid bounds
+        double t_enter = t_min, t_exit = closest_so_far;
+        for (int a = 0; a < 3; a++) {
+            auto inv_d = 1.0 / r.direction()[a];
+            auto t0 = (bounds.min()[a] - r.origin()[a]) * inv_d;
+            auto t1 = (bounds.max()[a] - r.origin()[a]) * inv_d;
+            if (inv_d < 0.0) std::swap(t0, t1);
+            t_enter = t0 > t_enter ? t0 : t_enter;
+            t_exit = t1 < t_exit ? t1 : t_exit;
+            if (t_exit < t_enter) return hit_anything;
+        }
+
+        // set up the walk: current cell, ray t at the next cell boundary and t step per cell on each axis
+        point3 p = r.at(t_enter);
+        int cell[3], step[3], out[3];
+        double next_t[3], delta_t[3];
+        for (int a = 0; a < 3; a++) {
+            cell[a] = static_cast<int>((p[a] - bounds.min()[a]) / cell_size[a]);
+            cell[a] = cell[a] < 0 ? 0 : (cell[a] >= res[a] ? res[a] - 1 : cell[a]);
+            auto d = r.direction()[a];
+            if (d > 0) {
+                next_t[a] = t_enter + (bounds.min()[a] + (cell[a]+1)*cell_size[a] - p[a]) / d;
+                delta_t[a] = cell_size[a] / d;
+                step[a] = 1;
+                out[a] = res[a];
+            } else if (d < 0) {
+                next_t[a] = t_enter + (bounds.min()[a] + cell[a]*cell_size[a] - p[a]) / d;
+                delta_t[a] = -cell_size[a] / d;
+                step[a] = -1;
+                out[a] = -1;
+            } else {
+                next_t[a] = infinity;
+                delta_t[a] = infinity;
+                step[a] = 0;
+                out[a] = -1;
+            }
+        }
+
+        while (true) {
+            int index = cell[0] + res[0]*(cell[1] + res[1]*cell[2]);
+            for (uint32_t i = cell_start[index]; i < cell_start[index+1]; i++) {
+                const hittable& object = *primitives[cell_objects[i]];
+                if (AnyHit) {
+                    if (object.occluded(r, t_min, t_max)) return true;
+                } else if (object.hit(r, t_min, closest_so_far, *rec)) {
+                    hit_anything = true;
+                    closest_so_far = rec->t;
+                }
+            }
+
+            int axis = next_t[0] < next_t[1] ? (next_t[0] < next_t[2] ? 0 : 2) : (next_t[1] < next_t[2] ? 1 : 2);
+            // a hit before the ray leaves this cell can't be beaten by any later cell
+            if (closest_so_far <= next_t[axis] || next_t[axis] > t_exit) break;
+            cell[axis] += step[axis];
+            if (cell[axis] == out[axis]) break;
+            next_t[axis] += delta_t[axis];
+        }
+
+        return hit_anything;
+    }
+
+    bool bounding_box(aabb& output_box) const override {
+        if (primitives.empty() && large_objects.empty()) return false;
+        output_box = bounds;
+        aabb temp_box;
+        for (const auto& object : large_objects) {
+            if (!object->bounding_box(temp_box)) return false;
+            output_box = surrounding_box(output_box, temp_box);
+        }
+        return true;
+    }
+
+private:
+    static double max_extent(const aabb& box) {
+        auto d = box.max() - box.min();
+        return fmax(d.x(), fmax(d.y(), d.z()));
+    }
+
+    // Picks cells per axis so the grid has about density * N roughly cubic cells. Thin axes
+    // (like the height of a layer of spheres) end up with a single cell.
+    void choose_resolution(double density) {
+        auto d = bounds.max() - bounds.min();
+        double volume = fmax(d.x(), 1e-9) * fmax(d.y(), 1e-9) * fmax(d.z(), 1e-9);
+        double cells_per_unit = std::cbrt(density * primitives.size() / volume);
+        for (int a = 0; a < 3; a++) {
+            int n = static_cast<int>(std::round(d[a] * cells_per_unit));
+            res[a] = n < 1 ? 1 : (n > grid_max_resolution ? grid_max_resolution : n);
+            cell_size[a] = d[a] > 0 ? d[a] / res[a] : 1.0;
+        }
+    }
+
+    template <typename F>
+    void for_each_cell(const aabb& box, F f) const {
+        int lo[3], hi[3];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = clamp_cell(static_cast<int>((box.min()[a] - bounds.min()[a]) / cell_size[a]), a);
+            hi[a] = clamp_cell(static_cast<int>((box.max()[a] - bounds.min()[a]) / cell_size[a]), a);
+        }
+        for (int z = lo[2]; z <= hi[2]; z++)
+            for (int y = lo[1]; y <= hi[1]; y++)
+                for (int x = lo[0]; x <= hi[0]; x++)
+                    f(x + res[0]*(y + res[1]*z));
+    }
+
+    int clamp_cell(int c, int axis) const {
+        return c < 0 ? 0 : (c >= res[axis] ? res[axis] - 1 : c);
+    }
+};
+
+#endif
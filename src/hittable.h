@@ -6,6 +6,8 @@
 #define HITTABLE_H
 
 #include "ray.h"
+#include "aabb.h"
+#include "packet.h"
 
 class material;
 
@@ -14,7 +16,9 @@ struct hit_record{
     vec3 normal;
     double t;
     bool front_face;
-    shared_ptr<material> mat_ptr;
+    // borrowed from the object that was hit (which owns the material), a plain pointer so
+    // copying records around in the hit loops costs no atomic reference count updates
+    const material* mat_ptr;
 
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
         front_face = dot(r.direction(), outward_normal) < 0;
@@ -25,6 +29,27 @@ struct hit_record{
 class hittable {
 public:
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+    // true if anything is hit in [t_min, t_max]. Meant for visibility tests (shadow rays), so it can
+    // stop at the first hit found and never computes normals or materials. The default falls back
+    // to hit() so custom objects work without overriding it.
+    virtual bool occluded(const ray& r, double t_min, double t_max) const {
+        hit_record rec;
+        return hit(r, t_min, t_max, rec);
+    }
+    // box enclosing the whole object, returns false if the object is unbounded
+    virtual bool bounding_box(aabb& output_box) const = 0;
+};
+
+// hittable that indexes other hittables, reports its memory footprint for the startup log
+class accelerator : public hittable {
+public:
+    virtual size_t node_count() const = 0;
+    virtual size_t node_bytes() const = 0;
+    // Closest hit of every ray of the packet into recs[i], hits[i] says if there was one.
+    // The default traces the rays one by one, bvhs with a packet traversal override it.
+    virtual void hit_packet(const ray_packet& packet, double t_min, double t_max, hit_record recs[], bool hits[]) const {
+        for (int i = 0; i < packet.count; i++) hits[i] = hit(packet.rays[i], t_min, t_max, recs[i]);
+    }
 };
 
 #endif
@@ -21,6 +21,7 @@ public:
 
     void clear() { objects.clear(); }
     void add(shared_ptr<hittable> object) { objects.push_back(object); }
+    const std::vector<shared_ptr<hittable>>& get_objects() const { return objects; }
 
     bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
         hit_record temp;
@@ -37,6 +38,25 @@ public:
 
         return hit_anything;
     }
+
+    bool occluded(const ray& r, double t_min, double t_max) const override {
+        for (const auto& object : objects) {
+            if (object->occluded(r, t_min, t_max)) return true;
+        }
+        return false;
+    }
+
+    bool bounding_box(aabb& output_box) const override {
+        if (objects.empty()) return false;
+
+        aabb temp_box;
+        output_box = aabb();
+        for (const auto& object : objects) {
+            if (!object->bounding_box(temp_box)) return false;
+            output_box = surrounding_box(output_box, temp_box);
+        }
+        return true;
+    }
 };
 
 #endif
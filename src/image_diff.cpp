@@ -0,0 +1,79 @@
+// Compares two binary PPM images of the same size and prints how far apart they are:
+//     ./image_diff a.ppm b.ppm [diff.ppm]
+// diff.ppm, if given, gets the per pixel difference scaled up 8 times.
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+struct image {
+    int width = 0, height = 0;
+    std::vector<uint8_t> data;
+};
+
+bool read_ppm(const char* path, image& img) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+    int max_value = 0;
+    bool ok = fscanf(file, "P6 %d %d %d", &img.width, &img.height, &max_value) == 3 && max_value == 255 && fgetc(file) != EOF;
+    if (ok) {
+        img.data.resize(size_t(img.width) * img.height * 3);
+        ok = fread(img.data.data(), 1, img.data.size(), file) == img.data.size();
+    }
+    fclose(file);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0] << " a.ppm b.ppm [diff.ppm]" << std::endl;
+        return 1;
+    }
+    image a, b;
+    if (!read_ppm(argv[1], a) || !read_ppm(argv[2], b)) {
+        std::cerr << "could not read " << (a.data.empty() ? argv[1] : argv[2]) << " as a binary PPM" << std::endl;
+        return 1;
+    }
+    if (a.width != b.width || a.height != b.height) {
+        std::cerr << "sizes differ: " << a.width << "x" << a.height << " vs " << b.width << "x" << b.height << std::endl;
+        return 1;
+    }
+
+    // per channel errors in 0-255 units, plus the share of pixels where some channel is visibly off
+    const int visible = 8;
+    double abs_sum = 0, squared_sum = 0;
+    int max_diff = 0;
+    long visible_pixels = 0;
+    std::vector<uint8_t> diff(a.data.size());
+    for (size_t p = 0; p < a.data.size(); p += 3) {
+        int pixel_max = 0;
+        for (int k = 0; k < 3; k++) {
+            int d = std::abs(int(a.data[p + k]) - int(b.data[p + k]));
+            abs_sum += d;
+            squared_sum += double(d) * d;
+            pixel_max = d > pixel_max ? d : pixel_max;
+            diff[p + k] = static_cast<uint8_t>(d * 8 > 255 ? 255 : d * 8);
+        }
+        max_diff = pixel_max > max_diff ? pixel_max : max_diff;
+        if (pixel_max > visible) visible_pixels++;
+    }
+    double n = double(a.data.size());
+    double rmse = sqrt(squared_sum / n);
+    std::cout << argv[1] << " vs " << argv[2] << " (" << a.width << "x" << a.height << "):" << std::endl;
+    std::cout << "  mean abs error " << abs_sum / n << ", rmse " << rmse << ", psnr "
+              << (rmse > 0 ? 20 * log10(255 / rmse) : INFINITY) << " dB, max " << max_diff << std::endl;
+    std::cout << "  pixels off by more than " << visible << ": " << 100.0 * visible_pixels / (n / 3) << "%" << std::endl;
+
+    if (argc > 3) {
+        FILE* file = fopen(argv[3], "wb");
+        if (!file) {
+            std::cerr << "could not write " << argv[3] << std::endl;
+            return 1;
+        }
+        fprintf(file, "P6\n%d %d\n255\n", a.width, a.height);
+        fwrite(diff.data(), 1, diff.size(), file);
+        fclose(file);
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "transform.h"
+#include "hittable.h"
+
+// One placement of shared geometry. The geometry (usually a bottom-level bvh over a group of
+// objects) is stored once and referenced by every instance. Rays are moved into the object's
+// space, so the top-level bvh over instances only ever needs the cached world bounds below.
+class instance : public hittable {
+public:
+    shared_ptr<hittable> object;
+
+    instance(shared_ptr<hittable> obj, const transform& object_to_world) : object(obj) {
+        set_transform(object_to_world);
+    }
+
+    // moving an instance only changes its world box, the shared geometry is untouched
+    void set_transform(const transform& object_to_world) {
+        to_world = object_to_world;
+        to_object = object_to_world.inverse();
+        aabb object_box;
+        has_box = object->bounding_box(object_box);
+        if (has_box) world_box = to_world.apply(object_box);
+    }
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        // affine map, so t is the same along the object space ray (its direction isn't normalized)
+        ray object_ray(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()));
+        if (!object->hit(object_ray, t_min, t_max, rec)) return false;
+
+        rec.p = r.at(rec.t);
+        // normals map with the inverse transpose, which keeps their side relative to the ray
+        rec.normal = unit_vector(to_object.apply_transposed(rec.normal));
+        return true;
+    }
+
+    bool occluded(const ray& r, double t_min, double t_max) const override {
+        ray object_ray(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()));
+        return object->occluded(object_ray, t_min, t_max);
+    }
+
+    bool bounding_box(aabb& output_box) const override {
+        output_box = world_box;
+        return has_box;
+    }
+
+private:
+    transform to_world;
+    transform to_object;
+    aabb world_box;
+    bool has_box;
+};
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef LBVH_H
+#define LBVH_H
+
+#include "flat_bvh.h"
+#include "threadpool.h"
+
+// bits of Morton code per axis, 3*21 = 63 bits total
+const int morton_bits_per_axis = 21;
+// arrays at least this big are sorted with all pool threads
+const size_t parallel_sort_threshold = 1 << 15;
+
+struct morton_prim {
+    uint64_t code;
+    uint32_t index;
+};
+
+// spreads the low 21 bits of v so there are two zero bits between each of them
+inline uint64_t expand_bits_21(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8)  & 0x100f00f00f00f00full;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2)  & 0x1249249249249249ull;
+    return v;
+}
+
+// interleaves x, y, z (x in the highest bit of each triple), p given in [0, 1]^3
+inline uint64_t morton_code(const point3& p) {
+    const double scale = double(1 << morton_bits_per_axis);
+    uint64_t q[3];
+    for (int a = 0; a < 3; a++) {
+        double v = p[a] * scale;
+        q[a] = v <= 0 ? 0 : (v >= scale - 1 ? uint64_t(scale - 1) : uint64_t(v));
+    }
+    return (expand_bits_21(q[0]) << 2) | (expand_bits_21(q[1]) << 1) | expand_bits_21(q[2]);
+}
+
+// Stable LSD radix sort on the 64-bit code, 8 bits per pass. Each pass counts digits per chunk
+// in parallel, turns the counts into per-chunk output offsets and scatters in parallel.
+// Bits below low_bit (a multiple of 8) are ignored, which saves their passes.
+inline void radix_sort(std::vector<morton_prim>& items, threadPool* pool, int low_bit = 0) {
+    size_t n = items.size();
+    int chunks = (pool && n >= parallel_sort_threshold) ? pool->size() : 1;
+    std::vector<morton_prim> temp(n);
+    std::vector<size_t> offsets(chunks * 256);
+
+    for (int shift = low_bit; shift < 64; shift += 8) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        parallel_chunks(pool, 0, n, chunks, [&](int c, size_t cs, size_t ce) {
+            size_t* count = &offsets[c * 256];
+            for (size_t i = cs; i < ce; i++) count[(items[i].code >> shift) & 0xff]++;
+        });
+
+        // digit-major, chunk-minor prefix sum keeps the sort stable across chunks
+        size_t sum = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            for (int c = 0; c < chunks; c++) {
+                size_t count = offsets[c*256 + digit];
+                offsets[c*256 + digit] = sum;
+                sum += count;
+            }
+        }
+
+        parallel_chunks(pool, 0, n, chunks, [&](int c, size_t cs, size_t ce) {
+            size_t* offset = &offsets[c * 256];
+            for (size_t i = cs; i < ce; i++) temp[offset[(items[i].code >> shift) & 0xff]++] = items[i];
+        });
+        items.swap(temp);
+    }
+}
+
+// Linear BVH (Lauterbach et al. / Karras): primitives are sorted along a Morton curve and the tree
+// falls out of the sorted codes, each node splits where its highest differing code bit flips.
+// Much faster to build than SAH, at the price of somewhat worse trees, so it suits scenes that
+// are rebuilt every frame.
+class lbvh_builder {
+public:
+    lbvh_builder(threadPool* pool = nullptr) : pool(pool) {}
+
+    void build(const hittable_list& list, flat_bvh& out) {
+        prims = make_bvh_primitives(list.get_objects());
+        out.nodes.clear();
+        out.primitives.clear();
+        out.leaf_spheres.clear();
+        out.leaf_closed.clear();
+        if (prims.empty()) return;
+
+        aabb centroids;
+        for (const auto& prim : prims) centroids = surrounding_box(centroids, aabb(prim.centroid, prim.centroid));
+        vec3 extent = centroids.max() - centroids.min();
+        vec3 inv_extent(extent.x() > 0 ? 1/extent.x() : 0, extent.y() > 0 ? 1/extent.y() : 0, extent.z() > 0 ? 1/extent.z() : 0);
+
+        sorted.resize(prims.size());
+        parallel_chunks(pool, 0, prims.size(), (pool && prims.size() >= parallel_sort_threshold) ? pool->size() : 1,
+            [&](int, size_t cs, size_t ce) {
+                for (size_t i = cs; i < ce; i++) {
+                    sorted[i].code = morton_code((prims[i].centroid - centroids.min()) * inv_extent);
+                    sorted[i].index = static_cast<uint32_t>(i);
+                }
+            });
+        radix_sort(sorted, pool);
+
+        out.nodes.reserve(2 * prims.size());
+        out.primitives.reserve(prims.size());
+        for (const auto& item : sorted) out.primitives.push_back(prims[item.index].object);
+        emit(out, 0, sorted.size(), sorted.size() > 1 ? build_split_tree() : -1, 0);
+        out.pack_leaves();
+    }
+
+private:
+    threadPool* pool;
+    std::vector<bvh_primitive> prims;
+    std::vector<morton_prim> sorted;
+
+    // children of each adjacent pair in the max-Cartesian tree of the pair keys, -1 for none
+    std::vector<int32_t> left_pair, right_pair;
+
+    // Orders adjacent pairs (i, i+1) of sorted by where a node splits. Pairs whose codes differ
+    // rank by their highest differing bit, above every pair of equal codes; equal codes rank by the
+    // highest bit where i and i+1 differ, the tie-break Karras uses, which halves runs of equal
+    // codes. In any range of sorted the pair with the largest key is unique and is where the
+    // range's node splits, so the split tree is the Cartesian tree of the keys.
+    static int pair_key(uint64_t a, uint64_t b, size_t i, int& axis) {
+        if (a != b) {
+            int bit = 63 - __builtin_clzll(a ^ b);
+            axis = 2 - bit % 3;
+            return 64 + bit;
+        }
+        axis = 0;
+        return 63 - __builtin_clzll(uint64_t(i) ^ uint64_t(i + 1));
+    }
+
+    // builds the Cartesian tree over all n-1 pairs with a stack in O(n), returns its root pair
+    int32_t build_split_tree() {
+        size_t pairs = sorted.size() - 1;
+        left_pair.assign(pairs, -1);
+        right_pair.assign(pairs, -1);
+        std::vector<int> keys(pairs);
+        std::vector<int32_t> stack;
+        int axis;
+        for (size_t i = 0; i < pairs; i++) {
+            keys[i] = pair_key(sorted[i].code, sorted[i+1].code, i, axis);
+            int32_t last = -1;
+            while (!stack.empty() && keys[stack.back()] < keys[i]) {
+                last = stack.back();
+                stack.pop_back();
+            }
+            left_pair[i] = last;
+            if (!stack.empty()) right_pair[stack.back()] = static_cast<int32_t>(i);
+            stack.push_back(static_cast<int32_t>(i));
+        }
+        return stack.front();
+    }
+
+    // Depth-first emission of the subtree over sorted[start, end), returns its bounds. pair is the
+    // split tree's node for the range, so each node finds its split in constant time.
+    aabb emit(flat_bvh& out, size_t start, size_t end, int32_t pair, int depth) {
+        int index = static_cast<int>(out.nodes.size());
+        out.nodes.emplace_back();
+
+        aabb box;
+        if (end - start == 1) {
+            box = prims[sorted[start].index].box;
+            out.nodes[index].primitives_offset = static_cast<int32_t>(start);
+            out.nodes[index].n_primitives = 1;
+        } else {
+            int axis = 0;
+            size_t mid;
+            int32_t left = -1, right = -1;
+            // keeps the tree within the traversal stack even for long runs of equal codes
+            if (depth >= max_bvh_depth/2) {
+                mid = start + (end - start)/2;
+            } else {
+                mid = pair + 1;
+                pair_key(sorted[pair].code, sorted[mid].code, pair, axis);
+                left = left_pair[pair];
+                right = right_pair[pair];
+            }
+            out.nodes[index].n_primitives = 0;
+            out.nodes[index].axis = static_cast<uint8_t>(axis);
+            aabb left_box = emit(out, start, mid, left, depth + 1);
+            out.nodes[index].second_child_offset = static_cast<int32_t>(out.nodes.size());
+            aabb right_box = emit(out, mid, end, right, depth + 1);
+            box = surrounding_box(left_box, right_box);
+        }
+        out.nodes[index].set_bounds(box);
+        return box;
+    }
+};
+
+#endif
@@ -1,9 +1,16 @@
 #include "common.h"
 #include "camera.h"
 #include "material.h"
+#include "accel.h"
+#include "bvh_cache.h"
+#include "render.h"
+#include "scenes.h"
+#include "grid.h"
+#include "instance.h"
 #include "window.h"
 #include "threadpool.h"
 #include <chrono>
+#include <cstdlib>
 #include <unistd.h>
 
 const int SAMPLES = 100;
@@ -11,6 +18,28 @@ const int MAX_DEPTH = 15;
 const double aspect_ratio = 3.0/2.0;
 const int WIDTH = 1000;
 const int HEIGHT = static_cast<int>(WIDTH / aspect_ratio);
+// uniform grid instead of a bvh, for comparing the two on dense scenes of similar objects
+const bool USE_GRID = false;
+// instanced_scene() instead of random_scene()
+const bool INSTANCED_SCENE = false;
+// binned_sah for static scenes, lbvh when the scene is rebuilt every frame
+const bvh_builder BUILDER = bvh_builder::binned_sah;
+// compressed quantizes the 8-wide nodes to 80 bytes, 2.8x less node memory at about the same speed
+const bvh_node_format NODES = bvh_node_format::full;
+// treelets regroup the full wide nodes by how likely they are visited, fewer TLB misses per ray
+// but the same cache line misses, for a slower build (see bench treelets)
+const bvh_node_layout LAYOUT = bvh_node_layout::depth_first;
+// trace the primary rays of 8x8 pixel tiles as packets, false for one ray per pixel
+const bool PACKETS = true;
+// trace one bounce of every pixel at a time and sort each bounce's rays by direction and origin
+// before tracing them (see render_wavefront), instead of following each path to its end
+const bool SORT_RAYS = false;
+// where the random numbers of each pixel's samples come from, sobol and blue_noise reach the same
+// noise level in fewer samples than independent numbers (see bench samplers)
+const sampler_kind SAMPLER = sampler_kind::sobol;
+// file the built bvh is kept in between runs and reused from while the scene stays the same, set
+// with RAY_BVH_CACHE=path, nullptr (the default) to always build and write nothing
+const char* BVH_CACHE = getenv("RAY_BVH_CACHE");
 
 const color WHITE = color(1, 1, 1);
 const color YELLOW = color(1, 1, 0);
@@ -22,40 +51,33 @@ const color DARK_BLUE = color(0, 0, 0.4);
 // array of pixels
 const int pix_arr_size = WIDTH * HEIGHT * 3;
 uint8_t render_pixels[pix_arr_size];
-double pixel_avg[pix_arr_size];
+real pixel_avg[pix_arr_size];
 
-color ray_color(const ray& r, const hittable& objects, int depth) {
-    if (depth <= 0) return BLACK;
+shared_ptr<sampler> render_sampler = make_sampler(SAMPLER);
 
-    hit_record rec;
-    if (objects.hit(r, 0.001, infinity, rec)) {
-        ray scattered;
-        color attenuation;
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
-            return attenuation * ray_color(scattered, objects, depth-1);
-        } else if (rec.mat_ptr->emanate(attenuation)) {
-            return attenuation;
-        }
-    }
-    // draw the background
-    // return BLACK;
-	vec3 unit_direction = unit_vector(r.direction());
-	auto y_linear = 0.5 * (unit_direction.y() + 1.0);
-	return (1.0 - y_linear)*WHITE + y_linear*SKY_BLUE;
+// The renderers of render.h and wavefront.h key the random numbers of pixel (i, j) in a sample
+// like this, and so does threadJob below, so each produces the same pixel_avg for the same seed
+// on any number of threads.
+path_key pixel_key(int i, int j, int sample) {
+    return path_key{rng_seed(), static_cast<uint32_t>(i), static_cast<uint32_t>(j), static_cast<uint32_t>(sample), render_sampler.get()};
 }
 
-void render(hittable_list& objects, camera& cam, int& sample) {
+// the renderers draw sample number `sample` of every pixel into this, it is then averaged into pixel_avg
+std::vector<color> sample_pixels;
+
+void render(const accelerator& objects, camera& cam, int& sample, threadPool* pool) {
     auto start = std::chrono::steady_clock::now();
-    for (int j = HEIGHT-1; j >= 0; --j) {
-    	for (int i = 0; i < WIDTH; ++i) {
-            auto u = (i + random_double())/(WIDTH-1);
-            auto v = (j + random_double())/(HEIGHT-1);
-            ray r = cam.get_ray(u,v);
-            color pixel = ray_color(r, objects, MAX_DEPTH);
-            int start_position = (i + j*WIDTH)*3;
-            write_color(render_pixels, pixel_avg, pixel, start_position, sample);
-    	}
-	}
+    if (SORT_RAYS) {
+        render_wavefront(objects, cam, WIDTH, HEIGHT, sample, MAX_DEPTH, true, sky_color, sample_pixels, nullptr, pool, render_sampler.get());
+    } else if (PACKETS) {
+        render_packets(objects, cam, WIDTH, HEIGHT, sample, MAX_DEPTH, sky_color, sample_pixels, pool, render_sampler.get());
+    } else {
+        render_rows(objects, cam, WIDTH, HEIGHT, sample, MAX_DEPTH, sky_color, sample_pixels, pool, render_sampler.get());
+    }
+    for (int p = 0; p < WIDTH * HEIGHT; p++) {
+        int start_position = p*3;
+        write_color(render_pixels, pixel_avg, sample_pixels[p], start_position, sample);
+    }
     auto end = std::chrono::steady_clock::now();
     auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
     std::cout << "Sample " << sample << ": " << elapsed << "ms" << std::endl;
@@ -66,16 +88,18 @@ class threadJob {
 public:
     int i;
     int j;
-    hittable_list objects;
+    const hittable& objects;
     camera cam;
     int sample;
-    threadJob(int& x, int& y, hittable_list& objs, camera& camera, int& sam) : i(x), j(y), objects(objs), cam(camera), sample(sam) {}
+    threadJob(int& x, int& y, const hittable& objs, camera& camera, int& sam) : i(x), j(y), objects(objs), cam(camera), sample(sam) {}
     
     void operator()() {
-        auto u = (i + random_double())/(WIDTH-1);
-        auto v = (j + random_double())/(HEIGHT-1);
-        ray r = cam.get_ray(u,v);
-        color pixel = ray_color(r, objects, MAX_DEPTH);
+        path_key key = pixel_key(i, j, sample);
+        sample_stream gen = key.bounce(0);
+        auto u = (i + random_double(gen))/(WIDTH-1);
+        auto v = (j + random_double(gen))/(HEIGHT-1);
+        ray r = cam.get_ray(u,v,gen);
+        color pixel = ray_color(r, objects, 0, MAX_DEPTH, key, sky_color);
         int start_position = (i + j*WIDTH)*3;
         write_color(render_pixels, pixel_avg, pixel, start_position, sample);
         // std::cout << "job done\n";
@@ -83,16 +107,18 @@ public:
 };
 
 
-void thread_Job(int& i, int& j, hittable_list& objects, camera& cam, int& sample) {
-    auto u = (i + random_double())/(WIDTH-1);
-    auto v = (j + random_double())/(HEIGHT-1);
-    ray r = cam.get_ray(u,v);
-    color pixel = ray_color(r, objects, MAX_DEPTH);
+void thread_Job(int& i, int& j, const hittable& objects, camera& cam, int& sample) {
+    path_key key = pixel_key(i, j, sample);
+    sample_stream gen = key.bounce(0);
+    auto u = (i + random_double(gen))/(WIDTH-1);
+    auto v = (j + random_double(gen))/(HEIGHT-1);
+    ray r = cam.get_ray(u,v,gen);
+    color pixel = ray_color(r, objects, 0, MAX_DEPTH, key, sky_color);
     int start_position = (i + j*WIDTH)*3;
     write_color(render_pixels, pixel_avg, pixel, start_position, sample);
 }
 
-void concurrent_render(threadPool& pool, hittable_list& objects, camera& cam, int& sample) {
+void concurrent_render(threadPool& pool, const hittable& objects, camera& cam, int& sample) {
     auto start = std::chrono::steady_clock::now();
     for (int j = HEIGHT-1; j >= 0; --j) {
     	for (int i = 0; i < WIDTH; ++i) {
@@ -137,60 +163,16 @@ vec3 parse_key(SDL_Keycode sym) {
     return vec;
 }
 
-hittable_list random_scene() {
-    hittable_list world;
-
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
-
-    for (int a = -5; a < 5; a++) {
-        for (int b = -5; b < 5; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.6) {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                } else if (choose_mat < 0.85) {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                } else {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
-        }
-    }
-
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-    return world;
-}
-
 int main() {
-    // threadPool pool;
-    // pool.start(4);
+    threadPool pool;
+    // hardware_concurrency() is 0 when unknown, and a pool without threads would never run the
+    // builder's jobs
+    pool.start(std::max(1u, std::thread::hardware_concurrency()));
 
     // CREATE WINDOW
     window win(WIDTH, HEIGHT);
     memset(render_pixels, 0, pix_arr_size);
-    memset(pixel_avg, 0, pix_arr_size);
+    memset(pixel_avg, 0, sizeof(pixel_avg));
 
     // // OBJECTS
     // hittable_list objects;
@@ -211,7 +193,22 @@ int main() {
     // objects.add(make_shared<sphere>(point3( 2.0,    0.0, -1.0),   0.5, material_rightmost));
     // objects.add(make_shared<sphere>(point3( 1.5,    0.0, -1.0-sqrt(3)/2),   0.5, material_last));
 
-    hittable_list objects = random_scene();
+    bvh_kernel kernel = detect_bvh_kernel();
+    hittable_list objects = INSTANCED_SCENE ? instanced_scene(kernel) : random_scene();
+    std::cout << "Sampler: " << sampler_kind_name(SAMPLER) << std::endl;
+
+    // ACCELERATION STRUCTURE
+    if (USE_GRID) std::cout << "Accelerator: uniform grid" << std::endl;
+    else std::cout << "BVH kernel: " << bvh_kernel_name(kernel) << ", builder: " << bvh_builder_name(BUILDER)
+                   << ", nodes: " << bvh_node_format_name(NODES) << ", layout: " << bvh_node_layout_name(LAYOUT) << std::endl;
+    auto build_start = std::chrono::steady_clock::now();
+    shared_ptr<accelerator> world;
+    if (USE_GRID) world = make_shared<grid_accel>(objects);
+    else if (BVH_CACHE) world = make_bvh(cached_flat_bvh(BVH_CACHE, objects, BUILDER, &pool), kernel, NODES, LAYOUT);
+    else world = make_bvh(objects, kernel, BUILDER, &pool, NODES, LAYOUT);
+    auto build_end = std::chrono::steady_clock::now();
+    std::cout << "Build: " << std::chrono::duration_cast<std::chrono::milliseconds>(build_end - build_start).count() << "ms, "
+              << world->node_count() << " nodes (" << world->node_bytes() << " bytes)" << std::endl;
 
 
 	// CAMERA
@@ -230,7 +227,7 @@ int main() {
     bool quit = false;
     while( !quit )
     {
-        render(objects, cam, sample);
+        render(*world, cam, sample, &pool);
         win.update(render_pixels);
         sample++;
 
@@ -244,7 +241,7 @@ int main() {
                 if (vec.length_squared() > 0) {
                     cam.move(vec);
                     memset(render_pixels, 0, pix_arr_size);
-                    memset(pixel_avg, 0, pix_arr_size);
+                    memset(pixel_avg, 0, sizeof(pixel_avg));
                     sample = 1;
                 }
             }
@@ -254,5 +251,5 @@ int main() {
 
     // clean up
     win.shutdown();
-    // pool.stop();
+    pool.stop();
 }
@@ -6,23 +6,42 @@
 #define MATERIAL_H
 
 #include "common.h"
+#include <cstdint>
+
+// The built in materials form a closed set tagged by kind, so the render loop can switch on
+// the tag and call them directly (see scatter_material below). Materials written outside this
+// file keep the default custom kind and are still called through the virtual interface.
+enum class material_kind : uint8_t { custom, lambertian, metal, dielectric, light };
 
 class material {
 public:
-    virtual bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
+    material_kind kind;
+
+    material(material_kind k = material_kind::custom) : kind(k) {}
+
+    // random choices come from gen, the numbers of this bounce of the path
+    virtual bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered, sample_stream& gen) const = 0;
     virtual bool emanate(color& attenuation) const = 0;
+
+    // with independent numbers seeded from the calling thread's rng. An override of the virtual
+    // scatter hides this one, so materials bring it back with `using material::scatter;`
+    bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered) const {
+        sample_stream gen(rng(thread_rng().next_u32()));
+        return scatter(r, rec, attenuation, scattered, gen);
+    }
 };
 
-class lambertian : public material {
+class lambertian final : public material {
 public:
     color albedo;
 
-    lambertian(const color& a): albedo(a) {}
+    lambertian(const color& a): material(material_kind::lambertian), albedo(a) {}
+
+    using material::scatter;
 
-    virtual bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered) const override {
-        auto dir = rec.normal + random_unit_vector()*random_scatter_scalar;
-        if (dir.near_zero()) dir = rec.normal;
-        scattered = ray(rec.p, dir);
+    virtual bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered, sample_stream& gen) const override {
+        // cosine weighted around the normal (unit for every shape), always a valid direction
+        scattered = ray(rec.p, random_cosine_direction(rec.normal, gen));
         attenuation = albedo;
         return true;
     }
@@ -30,16 +49,18 @@ public:
     virtual bool emanate(color& attenuation) const override { return false; }
 };
 
-class metal : public material {
+class metal final : public material {
 public:
     color albedo;
-    double fuzz;
+    real fuzz;
 
-    metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+    metal(const color& a, real f) : material(material_kind::metal), albedo(a), fuzz(f < 1 ? f : 1) {}
 
-    virtual bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered) const override {
+    using material::scatter;
+
+    virtual bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered, sample_stream& gen) const override {
         auto reflection = reflect(r.direction(), rec.normal);
-        scattered = ray(rec.p, reflection + fuzz*random_in_unit_sphere()*random_scatter_scalar);
+        scattered = ray(rec.p, reflection + fuzz*random_in_unit_sphere(gen)*random_scatter_scalar);
         attenuation = albedo;
         return (dot(scattered.direction(), rec.normal) > 0);
     }
@@ -47,30 +68,32 @@ public:
     virtual bool emanate(color& attenuation) const override { return false; }
 };
 
-class dielectric : public material {
+class dielectric final : public material {
 private:
-    static double reflectance(double cosine, double ref_idx) {
+    static real reflectance(real cosine, real ref_idx) {
         // Use Schlick's approximation for reflectance.
         auto r0 = (1-ref_idx) / (1+ref_idx);
         r0 = r0*r0;
         return r0 + (1-r0)*pow((1 - cosine),5);
     }
 public:
-    double ir;
+    real ir;
+
+    dielectric(real index_of_refraction) : material(material_kind::dielectric), ir(index_of_refraction) {}
 
-    dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+    using material::scatter;
 
-    virtual bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered) const override {
+    virtual bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered, sample_stream& gen) const override {
         attenuation = color(1.0, 1.0, 1.0);
-        double refraction_ratio = rec.front_face ? (1.0/ir) : ir;
+        real refraction_ratio = rec.front_face ? (1/ir) : ir;
 
         vec3 unit_direction = unit_vector(r.direction());
-        double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-        double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
+        real cos_theta = fmin(dot(-unit_direction, rec.normal), real(1));
+        real sin_theta = sqrt(1 - cos_theta*cos_theta);
 
         bool cannot_refract = refraction_ratio * sin_theta > 1.0;
         vec3 direction;
-        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
+        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double(gen))
             direction = reflect(unit_direction, rec.normal);
         else
             direction = refract(unit_direction, rec.normal, refraction_ratio);
@@ -82,11 +105,12 @@ public:
     virtual bool emanate(color& attenuation) const override { return false; }
 };
 
-class light : public material {
+class light final : public material {
 public:
     color albedo;
-    light(const color& a) : albedo(a) {}
-    virtual bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered) const override {
+    light(const color& a) : material(material_kind::light), albedo(a) {}
+    using material::scatter;
+    virtual bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered, sample_stream& gen) const override {
         return false;
     }
 
@@ -96,4 +120,29 @@ public:
     }
 };
 
+// The classes are final, so the qualified calls below are direct calls the compiler can inline
+// into the caller instead of a load from the vtable per bounce.
+inline bool scatter_material(const material& m, const ray& r, const hit_record& rec, color& attenuation, ray& scattered, sample_stream& gen) {
+    switch (m.kind) {
+        case material_kind::lambertian: return static_cast<const lambertian&>(m).lambertian::scatter(r, rec, attenuation, scattered, gen);
+        case material_kind::metal: return static_cast<const metal&>(m).metal::scatter(r, rec, attenuation, scattered, gen);
+        case material_kind::dielectric: return static_cast<const dielectric&>(m).dielectric::scatter(r, rec, attenuation, scattered, gen);
+        case material_kind::light: return false;
+        default: return m.scatter(r, rec, attenuation, scattered, gen);
+    }
+}
+
+inline bool scatter_material(const material& m, const ray& r, const hit_record& rec, color& attenuation, ray& scattered) {
+    sample_stream gen(rng(thread_rng().next_u32()));
+    return scatter_material(m, r, rec, attenuation, scattered, gen);
+}
+
+inline bool emanate_material(const material& m, color& attenuation) {
+    switch (m.kind) {
+        case material_kind::light: return static_cast<const light&>(m).light::emanate(attenuation);
+        case material_kind::custom: return m.emanate(attenuation);
+        default: return false;
+    }
+}
+
 #endif
\ No newline at end of file
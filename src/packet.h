@@ -0,0 +1,19 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "ray.h"
+
+// rays of an 8x8 pixel tile are traced as one packet
+const int packet_width = 8;
+const int packet_size = packet_width * packet_width;
+
+// Up to packet_size rays traced together by accelerator::hit_packet. Meant for coherent rays,
+// like the primary rays of neighbouring pixels, which mostly visit the same nodes.
+struct ray_packet {
+    ray rays[packet_size];
+    int count = 0;
+
+    void add(const ray& r) { rays[count++] = r; }
+};
+
+#endif
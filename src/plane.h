@@ -0,0 +1,39 @@
+#ifndef PLANE_H
+#define PLANE_H
+
+#include "common.h"
+
+// the plane through point with the given normal, fills everything in rec but the material
+inline bool hit_plane(const point3& point, const vec3& normal, const ray& r, double t_min, double t_max, hit_record& rec) {
+    auto denom = dot(normal, r.direction());
+    if (denom == 0) return false;
+    auto t = dot(point - r.origin(), normal) / denom;
+    if (t < t_min || t > t_max) return false;
+    rec.t = t;
+    rec.p = r.at(t);
+    rec.set_face_normal(r, normal);
+    return true;
+}
+
+// Infinite plane, e.g. a floor. It has no bounding box, so keep it next to the bvh in a
+// hittable_list (or in a primitive_list): the bvh builders reject it, grid_accel tests it on
+// every ray.
+class plane : public hittable {
+public:
+    point3 point;
+    vec3 normal;
+    shared_ptr<material> mat;
+
+    plane() = default;
+    plane(const point3& p, const vec3& n, shared_ptr<material> m) : point(p), normal(unit_vector(n)), mat(m) {}
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        if (!hit_plane(point, normal, r, t_min, t_max, rec)) return false;
+        rec.mat_ptr = mat.get();
+        return true;
+    }
+
+    bool bounding_box(aabb& output_box) const override { return false; }
+};
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef PRIMITIVE_H
+#define PRIMITIVE_H
+
+#include "common.h"
+#include "plane.h"
+#include "triangle.h"
+#include "box.h"
+#include <cstdint>
+#include <typeinfo>
+#include <vector>
+
+enum class primitive_type : uint8_t { sphere, plane, triangle, box };
+
+// One object of the closed primitive set stored by value, so arrays of them are contiguous and
+// intersecting one is a switch on type and an inlined call instead of a virtual call.
+//   sphere:   a = center, radius
+//   plane:    a = point, b = unit normal
+//   triangle: a, b, c = vertices
+//   box:      a = minimum, b = maximum
+// The material is borrowed, whoever fills the array keeps it alive.
+struct primitive {
+    point3 a, b, c;
+    double radius;
+    const material* mat;
+    primitive_type type;
+};
+
+inline bool hit_primitive(const primitive& p, const ray& r, double t_min, double t_max, hit_record& rec) {
+    bool hit;
+    switch (p.type) {
+        case primitive_type::sphere: hit = hit_sphere(p.a, p.radius, r, t_min, t_max, rec); break;
+        case primitive_type::plane: hit = hit_plane(p.a, p.b, r, t_min, t_max, rec); break;
+        case primitive_type::triangle: hit = hit_triangle(p.a, p.b, p.c, r, t_min, t_max, rec); break;
+        default: hit = hit_box(p.a, p.b, r, t_min, t_max, rec); break;
+    }
+    if (hit) rec.mat_ptr = p.mat;
+    return hit;
+}
+
+inline bool primitive_occludes(const primitive& p, const ray& r, double t_min, double t_max) {
+    if (p.type == primitive_type::sphere) return sphere_occludes(p.a, p.radius, r, t_min, t_max);
+    hit_record rec;
+    return hit_primitive(p, r, t_min, t_max, rec);
+}
+
+// false for planes, which are unbounded
+inline bool primitive_box(const primitive& p, aabb& output_box) {
+    switch (p.type) {
+        case primitive_type::sphere: output_box = sphere_box(p.a, p.radius); return true;
+        case primitive_type::plane: return false;
+        case primitive_type::triangle: output_box = triangle_box(p.a, p.b, p.c); return true;
+        default: output_box = aabb(p.a, p.b); return true;
+    }
+}
+
+inline bool is_closed_primitive(const hittable& object) {
+    const std::type_info& type = typeid(object);
+    return type == typeid(sphere) || type == typeid(plane) || type == typeid(triangle) || type == typeid(box);
+}
+
+// Value copy of object if its exact type is one of the closed set. Subclasses don't count,
+// they may override hit(), so they stay behind the virtual interface.
+inline bool to_primitive(const hittable& object, primitive& p) {
+    const std::type_info& type = typeid(object);
+    if (type == typeid(sphere)) {
+        const sphere& s = static_cast<const sphere&>(object);
+        p = primitive{s.center, point3(), point3(), s.rad, s.mat.get(), primitive_type::sphere};
+    } else if (type == typeid(plane)) {
+        const plane& s = static_cast<const plane&>(object);
+        p = primitive{s.point, s.normal, point3(), 0, s.mat.get(), primitive_type::plane};
+    } else if (type == typeid(triangle)) {
+        const triangle& s = static_cast<const triangle&>(object);
+        p = primitive{s.v0, s.v1, s.v2, 0, s.mat.get(), primitive_type::triangle};
+    } else if (type == typeid(box)) {
+        const box& s = static_cast<const box&>(object);
+        p = primitive{s.minimum, s.maximum, point3(), 0, s.mat.get(), primitive_type::box};
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Drop-in replacement for hittable_list: objects of the closed set are copied into a
+// contiguous array of primitives and dispatched by type, anything else (custom hittables,
+// bvhs, instances) is kept as is and still goes through the virtual interface.
+class primitive_list : public hittable {
+public:
+    std::vector<primitive> primitives;
+    std::vector<shared_ptr<hittable>> custom;
+
+    primitive_list() = default;
+    primitive_list(const hittable_list& list) {
+        for (const auto& object : list.get_objects()) add(object);
+    }
+
+    void add(shared_ptr<hittable> object) {
+        primitive p;
+        if (to_primitive(*object, p)) {
+            primitives.push_back(p);
+            owners.push_back(object); // keeps the material alive
+        } else {
+            custom.push_back(object);
+        }
+    }
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        bool hit_anything = false;
+        auto closest_so_far = t_max;
+
+        for (const auto& p : primitives) {
+            if (hit_primitive(p, r, t_min, closest_so_far, rec)) {
+                hit_anything = true;
+                closest_so_far = rec.t;
+            }
+        }
+        for (const auto& object : custom) {
+            if (object->hit(r, t_min, closest_so_far, rec)) {
+                hit_anything = true;
+                closest_so_far = rec.t;
+            }
+        }
+
+        return hit_anything;
+    }
+
+    bool occluded(const ray& r, double t_min, double t_max) const override {
+        for (const auto& p : primitives) {
+            if (primitive_occludes(p, r, t_min, t_max)) return true;
+        }
+        for (const auto& object : custom) {
+            if (object->occluded(r, t_min, t_max)) return true;
+        }
+        return false;
+    }
+
+    bool bounding_box(aabb& output_box) const override {
+        if (primitives.empty() && custom.empty()) return false;
+
+        aabb temp_box;
+        output_box = aabb();
+        for (const auto& p : primitives) {
+            if (!primitive_box(p, temp_box)) return false;
+            output_box = surrounding_box(output_box, temp_box);
+        }
+        for (const auto& object : custom) {
+            if (!object->bounding_box(temp_box)) return false;
+            output_box = surrounding_box(output_box, temp_box);
+        }
+        return true;
+    }
+
+private:
+    std::vector<shared_ptr<hittable>> owners;
+};
+
+#endif
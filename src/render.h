@@ -0,0 +1,106 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "wavefront.h"
+
+// The renderers that follow each path to its end, one ray at a time after the camera ray. Like
+// render_wavefront they render sample number `sample` of every pixel into pixels (width * height,
+// row j at j * width), draw every random number from the pixel's path_key and split the image
+// between the threads of pool, so the pixels only depend on the seed, the sampler and the sample
+// index, not on the number of threads.
+
+// color of ray r once its closest hit (if it has one) is known, the bounces after it are traced one
+// ray at a time. bounce counts up from 0 for the camera ray, and key.bounce(bounce + 1) gives the
+// numbers of the scatter at the hit, like render_wavefront
+inline color shade(const ray& r, bool hit, const hit_record& rec, const hittable& objects, int bounce, int max_depth,
+                   const path_key& key, color (*background)(const ray&));
+
+inline color ray_color(const ray& r, const hittable& objects, int bounce, int max_depth, const path_key& key,
+                       color (*background)(const ray&)) {
+    if (bounce >= max_depth) return color(0, 0, 0);
+
+    hit_record rec;
+    bool hit = objects.hit(r, 0.001, infinity, rec);
+    return shade(r, hit, rec, objects, bounce, max_depth, key, background);
+}
+
+inline color shade(const ray& r, bool hit, const hit_record& rec, const hittable& objects, int bounce, int max_depth,
+                   const path_key& key, color (*background)(const ray&)) {
+    if (hit) {
+        ray scattered;
+        color attenuation;
+        sample_stream gen = key.bounce(bounce + 1);
+        if (scatter_material(*rec.mat_ptr, r, rec, attenuation, scattered, gen)) {
+            return attenuation * ray_color(scattered, objects, bounce + 1, max_depth, key, background);
+        } else if (emanate_material(*rec.mat_ptr, attenuation)) {
+            return attenuation;
+        }
+    }
+    return background(r);
+}
+
+// Primary rays of each 8x8 tile go through the world as one packet, the rays they scatter into
+// are no longer coherent and continue one by one in shade(). The tile's camera numbers are drawn
+// together by camera_samples(), the same numbers render_rows draws one pixel at a time. The
+// threads of pool take rows of tiles.
+inline void render_packets(const accelerator& world, const camera& cam, int width, int height, int sample, int max_depth,
+                           color (*background)(const ray&), std::vector<color>& pixels,
+                           threadPool* pool = nullptr, const sampler* samples = nullptr) {
+    pixels.assign(width * height, color(0, 0, 0));
+    const uint64_t seed = rng_seed();
+    size_t tile_rows = (height + packet_width - 1) / packet_width;
+    parallel_chunks(pool, 0, tile_rows, pool ? pool->size() : 1, [&](int, size_t first_row, size_t end_row) {
+        ray_packet packet;
+        hit_record recs[packet_size];
+        bool hits[packet_size];
+        path_key keys[packet_size];
+        camera_sample tile[packet_size];
+        for (size_t row = first_row; row < end_row; row++) {
+            int tile_j = height-1 - static_cast<int>(row) * packet_width;
+            for (int tile_i = 0; tile_i < width; tile_i += packet_width) {
+                int count = 0;
+                for (int j = tile_j; j > tile_j - packet_width && j >= 0; --j) {
+                    for (int i = tile_i; i < tile_i + packet_width && i < width; ++i) {
+                        keys[count++] = path_key{seed, uint32_t(i), uint32_t(j), uint32_t(sample), samples};
+                    }
+                }
+                camera_samples(keys, count, tile);
+
+                packet.count = 0;
+                for (int k = 0; k < count; k++) {
+                    auto u = (keys[k].x + random_double(tile[k]))/(width-1);
+                    auto v = (keys[k].y + random_double(tile[k]))/(height-1);
+                    packet.add(cam.get_ray(u, v, tile[k]));
+                }
+                world.hit_packet(packet, 0.001, infinity, recs, hits);
+
+                for (int k = 0; k < count; k++) {
+                    pixels[keys[k].x + keys[k].y * width] = shade(packet.rays[k], hits[k], recs[k], world, 0, max_depth, keys[k], background);
+                }
+            }
+        }
+    });
+}
+
+// one ray per pixel, row by row, the threads of pool take bands of rows
+inline void render_rows(const hittable& objects, const camera& cam, int width, int height, int sample, int max_depth,
+                        color (*background)(const ray&), std::vector<color>& pixels,
+                        threadPool* pool = nullptr, const sampler* samples = nullptr) {
+    pixels.assign(width * height, color(0, 0, 0));
+    const uint64_t seed = rng_seed();
+    parallel_chunks(pool, 0, height, pool ? pool->size() : 1, [&](int, size_t first_row, size_t end_row) {
+        for (size_t row = first_row; row < end_row; row++) {
+            int j = height-1 - static_cast<int>(row);
+            for (int i = 0; i < width; ++i) {
+                path_key key{seed, uint32_t(i), uint32_t(j), uint32_t(sample), samples};
+                sample_stream gen = key.bounce(0);
+                auto u = (i + random_double(gen))/(width-1);
+                auto v = (j + random_double(gen))/(height-1);
+                ray r = cam.get_ray(u, v, gen);
+                pixels[i + j*width] = ray_color(r, objects, 0, max_depth, key, background);
+            }
+        }
+    });
+}
+
+#endif
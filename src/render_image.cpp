@@ -0,0 +1,100 @@
+// Renders random_scene() without a window and writes it as a binary PPM, so builds with a
+// different RAY_REAL or runs on a different number of threads can be compared (see make
+// precision_report and make determinism_check):
+//     ./render_image out.ppm [samples] [width] [seed] [threads] [renderer] [sums]
+// renderer is wavefront (the default), packets or rows, the renderers of main.cpp. sums names a
+// file the unrounded per-pixel sums are written to, in memory order, for comparing renders
+// before the 8 bit conversion.
+#include "scenes.h"
+#include "render.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+const int MAX_DEPTH = 15;
+const double aspect_ratio = 3.0/2.0;
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " out.ppm [samples] [width] [seed] [threads] [wavefront|packets|rows] [sums]" << std::endl;
+        return 1;
+    }
+    int samples = argc > 2 ? atoi(argv[2]) : 16;
+    int width = argc > 3 ? atoi(argv[3]) : 600;
+    int height = static_cast<int>(width / aspect_ratio);
+    // the scene is random too, so the seed is set before building it
+    seed_rng(argc > 4 ? atoi(argv[4]) : 1);
+    int threads = argc > 5 ? atoi(argv[5]) : 1;
+    std::string renderer = argc > 6 ? argv[6] : "wavefront";
+    if (threads < 1 || (renderer != "wavefront" && renderer != "packets" && renderer != "rows")) {
+        std::cerr << "threads must be at least 1 and the renderer wavefront, packets or rows" << std::endl;
+        return 1;
+    }
+    // the pool is used even with one thread, so that path is what gets compared
+    threadPool pool;
+    pool.start(threads);
+
+    hittable_list objects = random_scene();
+    shared_ptr<accelerator> world = make_bvh(objects, detect_bvh_kernel());
+    camera cam(point3(13,2,3), point3(0,1,0), vec3(0,1,0), 20, aspect_ratio, 0.1);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<color> sum(width * height), pixels;
+    for (int s = 0; s < samples; s++) {
+        if (renderer == "packets") render_packets(*world, cam, width, height, s + 1, MAX_DEPTH, sky_color, pixels, &pool);
+        else if (renderer == "rows") render_rows(*world, cam, width, height, s + 1, MAX_DEPTH, sky_color, pixels, &pool);
+        else render_wavefront(*world, cam, width, height, s + 1, MAX_DEPTH, false, sky_color, pixels, nullptr, &pool);
+        for (int p = 0; p < width * height; p++) sum[p] += pixels[p];
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    pool.stop();
+
+    // FNV-1a over the unrounded sums, equal hashes mean equal renders before the 8 bit conversion
+    uint64_t hash = 14695981039346656037ull;
+    for (const color& c : sum) {
+        for (int k = 0; k < 3; k++) {
+            real value = c[k];
+            unsigned char bytes[sizeof(real)];
+            memcpy(bytes, &value, sizeof(real));
+            for (unsigned char b : bytes) hash = (hash ^ b) * 1099511628211ull;
+        }
+    }
+
+    if (argc > 7) {
+        // components one by one, a SIMD vec3's padding lane is not part of the render
+        std::vector<real> values;
+        values.reserve(sum.size() * 3);
+        for (const color& c : sum) {
+            for (int k = 0; k < 3; k++) values.push_back(c[k]);
+        }
+        FILE* sums = fopen(argv[7], "wb");
+        bool written = sums && fwrite(values.data(), sizeof(real), values.size(), sums) == values.size();
+        if (sums) written = fclose(sums) == 0 && written;
+        if (!written) {
+            std::cerr << "could not write " << argv[7] << std::endl;
+            return 1;
+        }
+    }
+
+    FILE* file = fopen(argv[1], "wb");
+    if (!file) {
+        std::cerr << "could not write " << argv[1] << std::endl;
+        return 1;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    std::vector<uint8_t> row(width * 3);
+    // PPM rows go top to bottom, row j of the render is j up from the bottom
+    for (int j = height-1; j >= 0; --j) {
+        for (int i = 0; i < width; i++) {
+            color c = sum[i + j*width] / samples;
+            for (int k = 0; k < 3; k++) row[i*3 + k] = static_cast<uint8_t>(256 * clamp(sqrt(c[k]), 0.0, 0.999));
+        }
+        fwrite(row.data(), 1, row.size(), file);
+    }
+    fclose(file);
+    std::cout << argv[1] << ": " << width << "x" << height << ", " << samples << " samples, "
+              << (sizeof(real) == sizeof(float) ? "float" : "double") << ", " << renderer << ", " << threads << " threads, "
+              << elapsed << "ms, hash " << std::hex << hash << std::dec << std::endl;
+    return 0;
+}
@@ -0,0 +1,74 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <atomic>
+#include <cstdint>
+
+// PCG32 (O'Neill, pcg-random.org): 64 bits of state, 32 bit outputs, and 2^63 independent
+// streams picked by the odd increment. A handful of instructions per number and no shared
+// state, unlike rand(), which takes a global lock on glibc and gives 31 bit values.
+class rng {
+public:
+    rng(uint64_t seed = default_seed, uint64_t stream = 0) { reseed(seed, stream); }
+
+    void reseed(uint64_t seed, uint64_t stream) {
+        state = 0;
+        inc = stream << 1 | 1;
+        next_u32();
+        state += seed;
+        next_u32();
+    }
+
+    uint32_t next_u32() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ull + inc;
+        uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        uint32_t rot = static_cast<uint32_t>(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    // uniform in [0, 1)
+    double next_double() {
+        return next_u32() * (1.0 / 4294967296.0);
+    }
+
+    uint64_t stream() const { return inc >> 1; }
+
+    static const uint64_t default_seed = 0x853c49e6748fea9bull;
+
+private:
+    uint64_t state;
+    uint64_t inc;
+};
+
+// seed new thread generators start from, see seed_rng
+inline std::atomic<uint64_t>& rng_seed() {
+    static std::atomic<uint64_t> seed(rng::default_seed);
+    return seed;
+}
+
+// The calling thread's generator. Every thread gets its own stream of the same seed, numbered
+// in the order the threads first ask for one. Look it up once per job and pass it down rather
+// than calling this per number: it is a thread_local access.
+inline rng& thread_rng() {
+    static std::atomic<uint64_t> next_stream(0);
+    thread_local rng generator(rng_seed(), next_stream++);
+    return generator;
+}
+
+// Sets the seed of generators created from now on and restarts the calling thread's generator
+// (keeping its stream), e.g. to build the same random scene again.
+inline void seed_rng(uint64_t seed) {
+    rng_seed() = seed;
+    rng& generator = thread_rng();
+    generator.reseed(seed, generator.stream());
+}
+
+// splitmix64's finalizer, a bijection that spreads every input bit over the whole output
+inline uint64_t mix64(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+#endif
@@ -0,0 +1,380 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "rng.h"
+#include "rng_batch.h"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+// Every random number of a path is one dimension of its sample: the camera ray takes dimensions
+// 0 (pixel x), 1 (pixel y) and 2 onwards (lens), each bounce the next sampler_dimensions_per_bounce
+// for its scatter direction. A sampler decides what those numbers are. Independent numbers (the
+// default) converge like plain Monte Carlo, the low discrepancy samplers spread the samples of a
+// pixel evenly over each pair of dimensions and get to the same noise level with fewer samples.
+// Numbers a bounce draws beyond its share are always independent.
+const uint32_t sampler_dimensions_per_bounce = 4; // even, samplers work in pairs
+
+enum class sampler_kind { independent, halton, sobol, blue_noise };
+
+inline const char* sampler_kind_name(sampler_kind kind) {
+    switch (kind) {
+        case sampler_kind::independent: return "independent";
+        case sampler_kind::halton: return "halton";
+        case sampler_kind::sobol: return "sobol";
+        case sampler_kind::blue_noise: return "blue noise";
+    }
+    return "?";
+}
+
+class sampler;
+class sample_stream;
+
+// One path of a render: its pixel, its sample index, the render's seed and the sampler that
+// turns them into numbers. The numbers depend on nothing else, so a render comes out bit for
+// bit the same on any number of threads, in any tile order and with or without ray sorting.
+struct path_key {
+    uint64_t seed;
+    uint32_t x, y, sample;
+    const sampler* samples; // nullptr for independent numbers
+
+    // numbers of one bounce of the path, 0 being the camera ray
+    sample_stream bounce(uint32_t depth) const;
+};
+
+// hash of the key's seed and pixel with salt, for per pixel decorrelation
+inline uint64_t pixel_hash(const path_key& key, uint64_t salt) {
+    return mix64(mix64(key.seed + (uint64_t(key.x) << 32 | key.y)) + salt);
+}
+
+// Samplers hand out dimensions two at a time, the unit the sets below are stratified in.
+class sampler {
+public:
+    virtual ~sampler() {}
+
+    // dimensions 2 * pair and 2 * pair + 1 of sample key.sample of the key's pixel, in [0, 1)
+    virtual void sample_pair(const path_key& key, uint32_t pair, double values[2]) const = 0;
+};
+
+// Hands out the numbers of one bounce of one path in order. Each bounce has its own generator
+// (a PCG32 stream hashed from the key and the bounce), so bounces can be traced in separate
+// passes without carrying state along.
+class sample_stream {
+public:
+    sample_stream(const path_key& key, uint32_t bounce)
+        : key(key), first_dimension(bounce * sampler_dimensions_per_bounce), dimension(0), gen(seed(key, bounce)) {}
+
+    // independent numbers from gen
+    explicit sample_stream(const rng& gen) : key{0, 0, 0, 0, nullptr}, first_dimension(0), dimension(0), gen(gen) {}
+
+    double next_double() {
+        if (key.samples && dimension < sampler_dimensions_per_bounce) {
+            if ((dimension & 1) == 0) key.samples->sample_pair(key, (first_dimension + dimension) / 2, pair);
+            return pair[dimension++ & 1];
+        }
+        return gen.next_double();
+    }
+
+    // seed of the independent numbers of the key's bounce
+    static uint64_t seed(const path_key& key, uint32_t bounce) {
+        return mix64(mix64(key.seed + (uint64_t(key.x) << 32 | key.y)) + (uint64_t(key.sample) << 32 | bounce));
+    }
+
+private:
+    path_key key;
+    uint32_t first_dimension;
+    uint32_t dimension;
+    double pair[2];
+    rng gen;
+};
+
+inline sample_stream path_key::bounce(uint32_t depth) const {
+    return sample_stream(*this, depth);
+}
+
+// The numbers of a camera ray, worked out ahead of time by camera_samples() and handed out in
+// order like the path's bounce(0) stream: the pixel offset (2) and the lens position (2), which
+// is all a camera ray draws now. Numbers past those come from the key's stream as well, replayed
+// up to where this one is, slow but the same as drawing them from bounce(0). The key is the one
+// passed to camera_samples() and has to outlive the sample.
+class camera_sample {
+public:
+    camera_sample() : key(nullptr), drawn(0) {}
+    explicit camera_sample(const path_key& key) : key(&key), drawn(0) {}
+
+    double next_double() {
+        if (drawn < sampler_dimensions_per_bounce) return values[drawn++];
+        sample_stream rest = key->bounce(0);
+        for (uint32_t d = 0; d < drawn; d++) rest.next_double();
+        drawn++;
+        return rest.next_double();
+    }
+
+    double values[sampler_dimensions_per_bounce];
+
+private:
+    const path_key* key;
+    uint32_t drawn;
+};
+
+// Fills out[i] with the numbers keys[i].bounce(0) would give, for a tile of camera rays. Keys
+// without a sampler have their generators seeded and stepped 8 at a time by an rng_x8 instead of
+// one sample_stream each, keys with one take the sampler's first two pairs directly.
+inline void camera_samples(const path_key* keys, int count, camera_sample* out) {
+    const int lanes = rng_x8::lanes;
+    rng_x8 gen;
+    uint64_t seeds[lanes];
+    double numbers[lanes * sampler_dimensions_per_bounce];
+    for (int first = 0; first < count; first += lanes) {
+        int n = std::min(count - first, lanes);
+        bool independent = false;
+        for (int k = 0; k < lanes; k++) {
+            const path_key& key = keys[first + std::min(k, n - 1)]; // a short group repeats its last key
+            seeds[k] = key.samples ? 0 : sample_stream::seed(key, 0);
+            independent |= !key.samples;
+        }
+        if (independent) {
+            gen.reseed(seeds);
+            gen.fill_doubles(numbers, lanes * sampler_dimensions_per_bounce);
+        }
+        for (int k = 0; k < n; k++) {
+            const path_key& key = keys[first + k];
+            camera_sample& sample = out[first + k];
+            sample = camera_sample(key);
+            if (key.samples) {
+                for (uint32_t pair = 0; pair < sampler_dimensions_per_bounce / 2; pair++) key.samples->sample_pair(key, pair, &sample.values[2 * pair]);
+            } else {
+                for (uint32_t d = 0; d < sampler_dimensions_per_bounce; d++) sample.values[d] = numbers[d * lanes + k];
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// Halton: the radical inverse of the sample index in the dimension's prime base, shifted by a
+// per pixel random offset (Cranley-Patterson rotation) so pixels don't all get the same points.
+
+const uint32_t halton_primes[] = {
+    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+    137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223, 227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311
+};
+
+inline double radical_inverse(uint32_t base, uint32_t index) {
+    double inv_base = 1.0 / base, digit_weight = inv_base, result = 0;
+    while (index) {
+        result += (index % base) * digit_weight;
+        index /= base;
+        digit_weight *= inv_base;
+    }
+    return result;
+}
+
+inline double unit_from_bits(uint64_t bits) {
+    return (bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
+class halton_sampler final : public sampler {
+public:
+    virtual void sample_pair(const path_key& key, uint32_t pair, double values[2]) const override {
+        for (uint32_t i = 0; i < 2; i++) {
+            uint32_t dimension = 2 * pair + i;
+            double offset = unit_from_bits(pixel_hash(key, dimension));
+            // past the table (bounce 15 and up) the high bases barely stratify anyway
+            if (dimension >= sizeof(halton_primes) / sizeof(halton_primes[0])) {
+                values[i] = offset;
+                continue;
+            }
+            double value = radical_inverse(halton_primes[dimension], key.sample) + offset;
+            values[i] = value < 1 ? value : value - 1;
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------------------------
+// Sobol: the first two Sobol dimensions for every pair of dimensions, Owen scrambled and with
+// the sample order shuffled per pair (Burley 2020, "Practical Hash-based Owen Scrambling"). The
+// pairs don't line up with each other, which is what padding 2D sets needs.
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = __builtin_bswap32(x);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    return x;
+}
+
+// a random permutation of the bits of x where every bit only depends on the bits below it
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// Owen scrambling of a 0.32 fixed point number: every bit flipped depending on the bits above it
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+// Dimension 1 of the Sobol sequence (dimension 0 is reverse_bits(index)). It is linear in the
+// bits of index, so it's a lookup per byte: the shuffled indices are full 32 bit numbers, and
+// a loop over their bits was most of the sampler's time.
+inline uint32_t sobol_dimension_1(uint32_t index) {
+    struct tables {
+        uint32_t byte[4][256];
+        tables() {
+            uint32_t direction[32];
+            direction[0] = 1u << 31;
+            for (int i = 1; i < 32; i++) direction[i] = direction[i-1] ^ (direction[i-1] >> 1);
+            for (int b = 0; b < 4; b++) {
+                for (int value = 0; value < 256; value++) {
+                    uint32_t result = 0;
+                    for (int bit = 0; bit < 8; bit++) {
+                        if (value >> bit & 1) result ^= direction[b * 8 + bit];
+                    }
+                    byte[b][value] = result;
+                }
+            }
+        }
+    };
+    static const tables t;
+    return t.byte[0][index & 255] ^ t.byte[1][index >> 8 & 255] ^ t.byte[2][index >> 16 & 255] ^ t.byte[3][index >> 24];
+}
+
+// point `index` of a shuffled and scrambled 2D Sobol set, seed picks the set
+inline void owen_sobol(uint32_t index, uint64_t seed, double values[2]) {
+    uint32_t shuffled = nested_uniform_scramble(index, static_cast<uint32_t>(seed));
+    uint32_t x = nested_uniform_scramble(reverse_bits(shuffled), static_cast<uint32_t>(seed >> 32));
+    uint32_t y = nested_uniform_scramble(sobol_dimension_1(shuffled), static_cast<uint32_t>(mix64(seed)));
+    values[0] = x * (1.0 / 4294967296.0);
+    values[1] = y * (1.0 / 4294967296.0);
+}
+
+class sobol_sampler final : public sampler {
+public:
+    virtual void sample_pair(const path_key& key, uint32_t pair, double values[2]) const override {
+        owen_sobol(key.sample, pixel_hash(key, pair), values);
+    }
+};
+
+// ---------------------------------------------------------------------------------------------
+// Blue noise dithering (Georgiev and Fajardo 2016): every pixel gets the same scrambled Sobol
+// points, each rotated by the value of a blue noise tile at that pixel (shifted per dimension).
+// Each pixel still converges like Sobol, and what error is left is spread between neighbouring
+// pixels as high frequency noise instead of clumps, which looks smoother at low sample counts.
+
+const int blue_noise_size = 64; // power of two
+
+// Ranks of a blue_noise_size^2 void and cluster pattern (Ulichney 1993), turned into values in
+// (0, 1). Pixels are added one at a time into the largest void, the pixel farthest from all
+// others in a Gaussian weighted sense, so every prefix of the ranking is evenly spread. (The
+// last half also fills voids instead of removing clusters of the inverse pattern, which is close
+// enough for dithering.)
+inline std::vector<float> make_blue_noise_tile() {
+    const int size = blue_noise_size, n = size * size, mask = size - 1;
+    const double sigma = 1.9;
+    std::vector<double> kernel(n);
+    for (int dy = 0; dy < size; dy++) {
+        for (int dx = 0; dx < size; dx++) {
+            int wx = std::min(dx, size - dx), wy = std::min(dy, size - dy);
+            kernel[dy * size + dx] = exp(-(wx * wx + wy * wy) / (2 * sigma * sigma));
+        }
+    }
+    std::vector<char> on(n, 0);
+    std::vector<double> energy(n, 0);
+    auto toggle = [&](int p, bool set) {
+        on[p] = set;
+        int px = p % size, py = p / size;
+        double sign = set ? 1 : -1;
+        for (int q = 0; q < n; q++) energy[q] += sign * kernel[((q / size - py) & mask) * size + ((q % size - px) & mask)];
+    };
+    auto tightest_cluster = [&] {
+        int best = -1;
+        for (int p = 0; p < n; p++) if (on[p] && (best < 0 || energy[p] > energy[best])) best = p;
+        return best;
+    };
+    auto largest_void = [&] {
+        int best = -1;
+        for (int p = 0; p < n; p++) if (!on[p] && (best < 0 || energy[p] < energy[best])) best = p;
+        return best;
+    };
+
+    // start from 10% random points and move the most crowded one into the emptiest spot until
+    // that doesn't change anything
+    rng gen(1);
+    int initial = n / 10;
+    for (int placed = 0; placed < initial;) {
+        int p = gen.next_u32() % n;
+        if (!on[p]) {
+            toggle(p, true);
+            placed++;
+        }
+    }
+    while (true) {
+        int cluster = tightest_cluster();
+        toggle(cluster, false);
+        int hole = largest_void();
+        toggle(hole, true);
+        if (hole == cluster) break;
+    }
+
+    std::vector<int> rank(n);
+    std::vector<char> initial_on = on;
+    std::vector<double> initial_energy = energy;
+    for (int r = initial - 1; r >= 0; r--) {
+        int cluster = tightest_cluster();
+        toggle(cluster, false);
+        rank[cluster] = r;
+    }
+    on = initial_on;
+    energy = initial_energy;
+    for (int r = initial; r < n; r++) {
+        int hole = largest_void();
+        toggle(hole, true);
+        rank[hole] = r;
+    }
+
+    std::vector<float> tile(n);
+    for (int p = 0; p < n; p++) tile[p] = (rank[p] + 0.5f) / n;
+    return tile;
+}
+
+// built on first use, takes a few tens of milliseconds
+inline const std::vector<float>& blue_noise_tile() {
+    static const std::vector<float> tile = make_blue_noise_tile();
+    return tile;
+}
+
+class blue_noise_sampler final : public sampler {
+public:
+    blue_noise_sampler() : tile(blue_noise_tile()) {}
+
+    virtual void sample_pair(const path_key& key, uint32_t pair, double values[2]) const override {
+        owen_sobol(key.sample, mix64(key.seed + pair), values);
+        for (uint32_t i = 0; i < 2; i++) {
+            uint64_t shift = mix64(2 * pair + i + 1);
+            uint32_t x = (key.x + static_cast<uint32_t>(shift)) & (blue_noise_size - 1);
+            uint32_t y = (key.y + static_cast<uint32_t>(shift >> 32)) & (blue_noise_size - 1);
+            double value = values[i] + tile[y * blue_noise_size + x];
+            values[i] = value < 1 ? value : value - 1;
+        }
+    }
+
+private:
+    const std::vector<float>& tile;
+};
+
+// nullptr for independent, which path_key takes as numbers straight from the bounce's generator
+inline std::shared_ptr<sampler> make_sampler(sampler_kind kind) {
+    switch (kind) {
+        case sampler_kind::halton: return std::make_shared<halton_sampler>();
+        case sampler_kind::sobol: return std::make_shared<sobol_sampler>();
+        case sampler_kind::blue_noise: return std::make_shared<blue_noise_sampler>();
+        default: return nullptr;
+    }
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "common.h"
+#include "material.h"
+#include "accel.h"
+#include "instance.h"
+
+// Scenes shared by the interactive renderer and the headless tools
+
+// the background, what a ray leaving the scene sees
+inline color sky_color(const ray& r) {
+    // return color(0, 0, 0);
+    vec3 unit_direction = unit_vector(r.direction());
+    auto y_linear = 0.5 * (unit_direction.y() + 1.0);
+    return (1.0 - y_linear)*color(1, 1, 1) + y_linear*color(0.5, 0.7, 1.0);
+}
+
+inline hittable_list random_scene() {
+    hittable_list world;
+
+    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+
+    for (int a = -5; a < 5; a++) {
+        for (int b = -5; b < 5; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                shared_ptr<material> sphere_material;
+
+                if (choose_mat < 0.6) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = make_shared<lambertian>(albedo);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                } else if (choose_mat < 0.85) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = make_shared<metal>(albedo, fuzz);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                } else {
+                    // glass
+                    sphere_material = make_shared<dielectric>(1.5);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = make_shared<dielectric>(1.5);
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+
+    return world;
+}
+
+// Thousands of copies of one cluster of spheres. The cluster's bvh (bottom level) is built once and
+// shared by every instance, the top-level bvh built in main() only sees the instance boxes.
+inline hittable_list instanced_scene(bvh_kernel kernel) {
+    hittable_list world;
+
+    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+
+    hittable_list cluster;
+    for (int i = 0; i < 20; i++) {
+        auto albedo = color::random() * color::random();
+        point3 center(random_double(-0.5, 0.5), random_double(0.1, 0.8), random_double(-0.5, 0.5));
+        cluster.add(make_shared<sphere>(center, 0.1, make_shared<lambertian>(albedo)));
+    }
+    shared_ptr<hittable> cluster_bvh = make_bvh(cluster, kernel);
+
+    for (int a = -50; a < 50; a++) {
+        for (int b = -50; b < 50; b++) {
+            auto placement = transform::translate(vec3(a*1.5, 0, b*1.5)) * transform::rotate_y(random_double(0, 360));
+            world.add(make_shared<instance>(cluster_bvh, placement));
+        }
+    }
+
+    return world;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RAY_X86 1
+// lets one function use AVX2/FMA without building the whole program with -mavx2
+#define RAY_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+// checked once, the result decides which SIMD kernels are used
+inline bool cpu_has_avx2() {
+#if defined(RAY_X86)
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+inline bool cpu_has_sse2() {
+#if defined(__SSE2__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+#endif
@@ -7,41 +7,85 @@
 
 #include "hittable.h"
 
+// Surface of the sphere is (P-C) * (P-C) - r*r = 0
+// P = O + D*t where O is the ray origin and D is the direction
+// Substitute and get t*t*(D*D) + 2*t*(D*(O-C)) + (O-C)*(O-C) - r*r = 0
+// Solving for t, if there is a root, there is an intersection. Can just check discriminant at this point.
+// Fills everything in rec but the material.
+inline bool hit_sphere(const point3& center, real rad, const ray& r, double t_min, double t_max, hit_record& rec) {
+    vec3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - rad*rad;
+
+    auto discriminant = half_b*half_b - a*c;
+    if (discriminant < 0) return false;
+
+    // if hit, populate the hit record
+    auto root = (-half_b - sqrt(discriminant))/a;
+
+    // handle t_min, t_max
+    if (root < t_min || root > t_max) {
+        root =  (-half_b + sqrt(discriminant))/a;
+        if (root < t_min || root > t_max) return false;
+    }
+
+    rec.t = root;
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p-center)/rad;
+    rec.set_face_normal(r, outward_normal);
+    return true;
+}
+
+inline bool sphere_occludes(const point3& center, real rad, const ray& r, double t_min, double t_max) {
+    vec3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - rad*rad;
+
+    auto discriminant = half_b*half_b - a*c;
+    if (discriminant < 0) return false;
+
+    auto sqrtd = sqrt(discriminant);
+    auto root = (-half_b - sqrtd)/a;
+    if (root >= t_min && root <= t_max) return true;
+    root = (-half_b + sqrtd)/a;
+    return root >= t_min && root <= t_max;
+}
+
+inline aabb sphere_box(const point3& center, real rad) {
+    // abs so spheres with a negative radius (hollow glass) still get a valid box
+    auto r = fabs(rad);
+    return aabb(center - vec3(r, r, r), center + vec3(r, r, r));
+}
+
 class sphere : public hittable {
 public:
     point3 center;
-    double rad;
+    real rad;
     shared_ptr<material> mat;
 
     sphere() = default;
-    sphere(point3 c, double r, shared_ptr<material> m) : center(c), rad(r), mat(m) {}
+    sphere(point3 c, real r, shared_ptr<material> m) : center(c), rad(r), mat(m) {}
+
+    // moves the sphere in place, acceleration structures holding it must be refit afterwards
+    void update(const point3& c, real r) {
+        center = c;
+        rad = r;
+    }
+
     bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
-        // Surface of the sphere is (P-C) * (P-C) - r*r = 0
-        // P = O + D*t where O is the ray origin and D is the direction
-        // Substitute and get t*t*(D*D) + 2*t*(D*(O-C)) + (O-C)*(O-C) - r*r = 0
-        // Solving for t, if there is a root, there is an intersection. Can just check discriminant at this point.
-        vec3 oc = r.origin() - center;
-        auto a = r.direction().length_squared();
-        auto half_b = dot(oc, r.direction());
-        auto c = oc.length_squared() - rad*rad;
-
-        auto discriminant = half_b*half_b - a*c;
-        if (discriminant < 0) return false;
-
-        // if hit, populate the hit record
-        auto root = (-half_b - sqrt(discriminant))/a;
-
-        // handle t_min, t_max
-        if (root < t_min || root > t_max) {
-            root =  (-half_b + sqrt(discriminant))/a;
-            if (root < t_min || root > t_max) return false;
-        }
-
-        rec.t = root;
-        rec.p = r.at(rec.t);
-        vec3 outward_normal = (rec.p-center)/rad;
-        rec.set_face_normal(r, outward_normal);
-        rec.mat_ptr = mat;
+        if (!hit_sphere(center, rad, r, t_min, t_max, rec)) return false;
+        rec.mat_ptr = mat.get();
+        return true;
+    }
+
+    bool occluded(const ray& r, double t_min, double t_max) const override {
+        return sphere_occludes(center, rad, r, t_min, t_max);
+    }
+
+    bool bounding_box(aabb& output_box) const override {
+        output_box = sphere_box(center, rad);
         return true;
     }
 };
@@ -0,0 +1,273 @@
+#ifndef SPHERE_SOA_H
+#define SPHERE_SOA_H
+
+#include "sphere.h"
+#include "aligned.h"
+#include "simd.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// widest SIMD block of spheres, the arrays keep this many - 1 padding entries past the last
+// sphere so a block starting at any index can be loaded whole
+const size_t sphere_soa_block = 4;
+
+// Spheres stored as structure of arrays (centers, radii and material ids each in their own
+// aligned array), so one ray is tested against a block of spheres per instruction: four with
+// AVX2, two with SSE2. Lanes stay double precision like the rest of the renderer, float lanes
+// lose too much in oc*oc - r*r for big spheres such as the ground. The closest hit of a block
+// comes out of a horizontal min and the hit record is only filled once, for the final winner.
+// Use it directly for small scenes or as the leaf storage of an acceleration structure, which
+// intersects contiguous index ranges with hit_range()/occluded_range().
+class sphere_soa : public hittable {
+public:
+    sphere_soa() = default;
+    sphere_soa(const std::vector<shared_ptr<sphere>>& spheres) {
+        for (const auto& s : spheres) add(*s);
+    }
+
+    void add(const sphere& s) { add(s.center, s.rad, s.mat); }
+
+    void reserve(size_t n) {
+        cx.reserve(n + sphere_soa_block);
+        cy.reserve(n + sphere_soa_block);
+        cz.reserve(n + sphere_soa_block);
+        rad.reserve(n + sphere_soa_block);
+        material_id.reserve(n + sphere_soa_block);
+    }
+
+    void add(const point3& center, double radius, const shared_ptr<material>& mat) {
+        size_t i = count++;
+        if (count + sphere_soa_block - 1 > cx.size()) {
+            size_t padded = cx.size() + sphere_soa_block;
+            cx.resize(padded, 0);
+            cy.resize(padded, 0);
+            cz.resize(padded, 0);
+            rad.resize(padded, 0);
+            material_id.resize(padded, 0);
+        }
+        set(i, center, radius);
+        material_id[i] = material_index(mat);
+    }
+
+    // moves sphere i in place, same as sphere::update
+    void set(size_t i, const point3& center, double radius) {
+        cx[i] = center.x();
+        cy[i] = center.y();
+        cz[i] = center.z();
+        rad[i] = radius;
+    }
+
+    void clear() {
+        count = 0;
+        cx.clear();
+        cy.clear();
+        cz.clear();
+        rad.clear();
+        material_id.clear();
+        materials.clear();
+        material_ids.clear();
+        last_material_id = 0;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        double closest_so_far = t_max;
+        return hit_range(r, 0, count, t_min, closest_so_far, rec);
+    }
+
+    bool occluded(const ray& r, double t_min, double t_max) const override {
+        return occluded_range(r, 0, count, t_min, t_max);
+    }
+
+    // Closest hit among spheres [begin, end) with t in [t_min, closest_so_far]. On a hit rec
+    // is filled and closest_so_far lowered to its t, otherwise both are left alone.
+    bool hit_range(const ray& r, size_t begin, size_t end, double t_min, double& closest_so_far, hit_record& rec) const {
+        double t = closest_so_far;
+        long best;
+#if defined(RAY_X86)
+        if (cpu_has_avx2()) best = closest_avx2(r, begin, end, t_min, t);
+        else best = closest_sse2(r, begin, end, t_min, t);
+#else
+        best = closest_scalar(r, begin, end, t_min, t);
+#endif
+        if (best < 0) return false;
+
+        closest_so_far = t;
+        rec.t = t;
+        rec.p = r.at(t);
+        vec3 outward_normal = (rec.p - point3(cx[best], cy[best], cz[best])) / rad[best];
+        rec.set_face_normal(r, outward_normal);
+        rec.mat_ptr = materials[material_id[best]].get();
+        return true;
+    }
+
+    bool occluded_range(const ray& r, size_t begin, size_t end, double t_min, double t_max) const {
+        // any hit will do, so the closest search returns as soon as a block has one
+#if defined(RAY_X86)
+        if (cpu_has_avx2()) return closest_avx2(r, begin, end, t_min, t_max, true) >= 0;
+        return closest_sse2(r, begin, end, t_min, t_max, true) >= 0;
+#else
+        return closest_scalar(r, begin, end, t_min, t_max, true) >= 0;
+#endif
+    }
+
+    bool bounding_box(aabb& output_box) const override {
+        if (count == 0) return false;
+        output_box = aabb();
+        for (size_t i = 0; i < count; i++) {
+            auto r = fabs(rad[i]);
+            point3 c(cx[i], cy[i], cz[i]);
+            output_box = surrounding_box(output_box, aabb(c - vec3(r, r, r), c + vec3(r, r, r)));
+        }
+        return true;
+    }
+
+    size_t bytes() const {
+        return cx.size() * (4*sizeof(double) + sizeof(uint32_t)) + materials.size() * sizeof(shared_ptr<material>);
+    }
+
+private:
+    using double_array = std::vector<double, aligned_allocator<double, 64>>;
+
+    size_t count = 0;
+    double_array cx, cy, cz, rad;
+    std::vector<uint32_t> material_id;
+    std::vector<shared_ptr<material>> materials; // each distinct material once
+    std::unordered_map<const material*, uint32_t> material_ids;
+    uint32_t last_material_id = 0;
+
+    uint32_t material_index(const shared_ptr<material>& mat) {
+        // neighbouring spheres often share a material, this skips the hash lookup for them
+        if (!materials.empty() && materials[last_material_id] == mat) return last_material_id;
+        auto found = material_ids.find(mat.get());
+        if (found != material_ids.end()) return last_material_id = found->second;
+        uint32_t id = static_cast<uint32_t>(materials.size());
+        materials.push_back(mat);
+        material_ids[mat.get()] = id;
+        return last_material_id = id;
+    }
+
+    // Same root selection as sphere::hit: the near root if it's in range, else the far one.
+    // Returns the index of the closest sphere and lowers t_max to its t, or -1 on a miss.
+    // Spheres at equal t resolve to the later one, like a hittable_list of sphere objects.
+    long closest_scalar(const ray& r, size_t begin, size_t end, double t_min, double& t_max, bool any = false) const {
+        long best = -1;
+        auto a = r.direction().length_squared();
+        for (size_t i = begin; i < end; i++) {
+            vec3 oc = r.origin() - point3(cx[i], cy[i], cz[i]);
+            auto half_b = dot(oc, r.direction());
+            auto c = oc.length_squared() - rad[i]*rad[i];
+            auto discriminant = half_b*half_b - a*c;
+            if (discriminant < 0) continue;
+            auto sqrtd = sqrt(discriminant);
+            auto root = (-half_b - sqrtd)/a;
+            if (root < t_min || root > t_max) {
+                root = (-half_b + sqrtd)/a;
+                if (root < t_min || root > t_max) continue;
+            }
+            best = static_cast<long>(i);
+            t_max = root;
+            if (any) return best;
+        }
+        return best;
+    }
+
+#if defined(RAY_X86)
+    // two spheres per instruction, SSE2 is always there on x86-64
+    long closest_sse2(const ray& r, size_t begin, size_t end, double t_min, double& t_max, bool any = false) const {
+        long best = -1;
+        const __m128d ox = _mm_set1_pd(r.origin().x()), oy = _mm_set1_pd(r.origin().y()), oz = _mm_set1_pd(r.origin().z());
+        const __m128d dx = _mm_set1_pd(r.direction().x()), dy = _mm_set1_pd(r.direction().y()), dz = _mm_set1_pd(r.direction().z());
+        const __m128d a = _mm_set1_pd(r.direction().length_squared());
+        const __m128d lo = _mm_set1_pd(t_min);
+        const __m128d inf = _mm_set1_pd(infinity);
+        const __m128d zero = _mm_setzero_pd();
+        const __m128d lanes = _mm_set_pd(1, 0);
+        const __m128d last = _mm_set1_pd(double(end));
+        for (size_t i = begin; i < end; i += 2) {
+            __m128d ocx = _mm_sub_pd(ox, _mm_loadu_pd(&cx[i]));
+            __m128d ocy = _mm_sub_pd(oy, _mm_loadu_pd(&cy[i]));
+            __m128d ocz = _mm_sub_pd(oz, _mm_loadu_pd(&cz[i]));
+            __m128d radius = _mm_loadu_pd(&rad[i]);
+            __m128d half_b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, dx), _mm_mul_pd(ocy, dy)), _mm_mul_pd(ocz, dz));
+            __m128d c = _mm_sub_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)), _mm_mul_pd(ocz, ocz)),
+                                   _mm_mul_pd(radius, radius));
+            __m128d discriminant = _mm_sub_pd(_mm_mul_pd(half_b, half_b), _mm_mul_pd(a, c));
+            __m128d valid = _mm_and_pd(_mm_cmpge_pd(discriminant, zero),
+                                       _mm_cmplt_pd(_mm_add_pd(_mm_set1_pd(double(i)), lanes), last));
+            if (_mm_movemask_pd(valid) == 0) continue;
+
+            __m128d sqrtd = _mm_sqrt_pd(_mm_max_pd(discriminant, zero));
+            __m128d hi = _mm_set1_pd(t_max);
+            __m128d near = _mm_div_pd(_mm_sub_pd(_mm_sub_pd(zero, half_b), sqrtd), a);
+            __m128d far = _mm_div_pd(_mm_add_pd(_mm_sub_pd(zero, half_b), sqrtd), a);
+            __m128d near_in = _mm_and_pd(_mm_cmpge_pd(near, lo), _mm_cmple_pd(near, hi));
+            __m128d far_in = _mm_and_pd(_mm_cmpge_pd(far, lo), _mm_cmple_pd(far, hi));
+            __m128d in = _mm_and_pd(valid, _mm_or_pd(near_in, far_in));
+            if (_mm_movemask_pd(in) == 0) continue;
+
+            // near root if in range, else far root, misses pushed to infinity before the horizontal min
+            __m128d t = _mm_or_pd(_mm_and_pd(near_in, near), _mm_andnot_pd(near_in, far));
+            t = _mm_or_pd(_mm_and_pd(in, t), _mm_andnot_pd(in, inf));
+            __m128d m = _mm_min_pd(t, _mm_shuffle_pd(t, t, 1));
+            int lane = 31 - __builtin_clz(_mm_movemask_pd(_mm_cmpeq_pd(t, m)));
+            t_max = _mm_cvtsd_f64(m);
+            best = static_cast<long>(i) + lane;
+            if (any) return best;
+        }
+        return best;
+    }
+
+    // four spheres per instruction, only called after cpu_has_avx2() said yes
+    RAY_TARGET_AVX2
+    long closest_avx2(const ray& r, size_t begin, size_t end, double t_min, double& t_max, bool any = false) const {
+        long best = -1;
+        const __m256d ox = _mm256_set1_pd(r.origin().x()), oy = _mm256_set1_pd(r.origin().y()), oz = _mm256_set1_pd(r.origin().z());
+        const __m256d dx = _mm256_set1_pd(r.direction().x()), dy = _mm256_set1_pd(r.direction().y()), dz = _mm256_set1_pd(r.direction().z());
+        const __m256d a = _mm256_set1_pd(r.direction().length_squared());
+        const __m256d lo = _mm256_set1_pd(t_min);
+        const __m256d inf = _mm256_set1_pd(infinity);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d lanes = _mm256_set_pd(3, 2, 1, 0);
+        const __m256d last = _mm256_set1_pd(double(end));
+        for (size_t i = begin; i < end; i += 4) {
+            __m256d ocx = _mm256_sub_pd(ox, _mm256_loadu_pd(&cx[i]));
+            __m256d ocy = _mm256_sub_pd(oy, _mm256_loadu_pd(&cy[i]));
+            __m256d ocz = _mm256_sub_pd(oz, _mm256_loadu_pd(&cz[i]));
+            __m256d radius = _mm256_loadu_pd(&rad[i]);
+            __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+            __m256d c = _mm256_sub_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz)),
+                                      _mm256_mul_pd(radius, radius));
+            __m256d discriminant = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(a, c));
+            __m256d valid = _mm256_and_pd(_mm256_cmp_pd(discriminant, zero, _CMP_GE_OQ),
+                                          _mm256_cmp_pd(_mm256_add_pd(_mm256_set1_pd(double(i)), lanes), last, _CMP_LT_OQ));
+            if (_mm256_movemask_pd(valid) == 0) continue;
+
+            __m256d sqrtd = _mm256_sqrt_pd(_mm256_max_pd(discriminant, zero));
+            __m256d hi = _mm256_set1_pd(t_max);
+            __m256d near = _mm256_div_pd(_mm256_sub_pd(_mm256_sub_pd(zero, half_b), sqrtd), a);
+            __m256d far = _mm256_div_pd(_mm256_add_pd(_mm256_sub_pd(zero, half_b), sqrtd), a);
+            __m256d near_in = _mm256_and_pd(_mm256_cmp_pd(near, lo, _CMP_GE_OQ), _mm256_cmp_pd(near, hi, _CMP_LE_OQ));
+            __m256d far_in = _mm256_and_pd(_mm256_cmp_pd(far, lo, _CMP_GE_OQ), _mm256_cmp_pd(far, hi, _CMP_LE_OQ));
+            __m256d in = _mm256_and_pd(valid, _mm256_or_pd(near_in, far_in));
+            if (_mm256_movemask_pd(in) == 0) continue;
+
+            // near root if in range, else far root, misses pushed to infinity before the horizontal min
+            __m256d t = _mm256_blendv_pd(_mm256_blendv_pd(inf, far, far_in), near, near_in);
+            t = _mm256_blendv_pd(inf, t, in);
+            __m256d m = _mm256_min_pd(t, _mm256_permute2f128_pd(t, t, 1));
+            m = _mm256_min_pd(m, _mm256_permute_pd(m, 5));
+            int lane = 31 - __builtin_clz(_mm256_movemask_pd(_mm256_cmp_pd(t, m, _CMP_EQ_OQ)));
+            t_max = _mm256_cvtsd_f64(m);
+            best = static_cast<long>(i) + lane;
+            if (any) return best;
+        }
+        return best;
+    }
+#endif
+};
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
+#include <condition_variable>
 #include <functional>
+#include <mutex>
 #include <thread>
 #include <queue>
 #include <iostream>
@@ -13,12 +15,16 @@ public:
     void queueJob(const std::function<void()>& job);
     void stop();
     bool busy();
+    void wait();
+    int size() const { return static_cast<int>(threads.size()); }
     void threadLoop();
 
 private:
     bool should_terminate = false;           // Tells threads to stop looking for jobs
     std::mutex queue_mutex;                  // Prevents data races to the job queue
     std::condition_variable mutex_condition; // Allows threads to wait on new jobs or termination 
+    std::condition_variable idle_condition;  // Signals wait() when the last running job finishes
+    int active_jobs = 0;                     // Jobs dequeued but not finished yet
     std::vector<std::thread> threads;
     std::queue<std::function<void()>> jobs;
 };
@@ -50,9 +56,15 @@ void threadPool::threadLoop() {
             }
             job = jobs.front();
             jobs.pop();
+            active_jobs++;
             // std::cout << "Dequeued Job" << std::endl;
         }
         job();
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            active_jobs--;
+        }
+        idle_condition.notify_all();
     }
 }
 
@@ -69,11 +81,35 @@ bool threadPool::busy() {
     bool poolbusy;
     {
         std::unique_lock<std::mutex> lock(queue_mutex);
-        poolbusy = jobs.empty();
+        poolbusy = !jobs.empty() || active_jobs > 0;
     }
     return poolbusy;
 }
 
+// blocks until every queued job has run, must not be called from inside a job
+void threadPool::wait() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    idle_condition.wait(lock, [this] {
+        return jobs.empty() && active_jobs == 0;
+    });
+}
+
+// Runs f(chunk, start, end) over `chunks` contiguous pieces of [start, end) on the pool and waits
+// for all of them. Runs inline when there is no pool or only one chunk.
+template <typename F>
+void parallel_chunks(threadPool* pool, size_t start, size_t end, int chunks, F f) {
+    size_t n = end - start;
+    if (!pool || chunks <= 1) {
+        f(0, start, end);
+        return;
+    }
+    for (int c = 0; c < chunks; c++) {
+        size_t cs = start + n*c/chunks, ce = start + n*(c+1)/chunks;
+        pool->queueJob([f, c, cs, ce] { f(c, cs, ce); });
+    }
+    pool->wait();
+}
+
 void threadPool::stop() {
     {
         std::unique_lock<std::mutex> lock(queue_mutex);
@@ -0,0 +1,93 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "aabb.h"
+
+// affine transform p -> m*p + t
+class transform {
+public:
+    double m[3][3];
+    vec3 t;
+
+    transform() : m{{1,0,0},{0,1,0},{0,0,1}}, t(0,0,0) {}
+
+    static transform translate(const vec3& offset) {
+        transform x;
+        x.t = offset;
+        return x;
+    }
+
+    static transform scale(double s) {
+        transform x;
+        x.m[0][0] = x.m[1][1] = x.m[2][2] = s;
+        return x;
+    }
+
+    static transform rotate_y(double degrees) {
+        transform x;
+        auto theta = degrees_to_radians(degrees);
+        x.m[0][0] = cos(theta);  x.m[0][2] = sin(theta);
+        x.m[2][0] = -sin(theta); x.m[2][2] = cos(theta);
+        return x;
+    }
+
+    point3 apply_point(const point3& p) const { return apply_vector(p) + t; }
+
+    vec3 apply_vector(const vec3& v) const {
+        return vec3(m[0][0]*v[0] + m[0][1]*v[1] + m[0][2]*v[2],
+                    m[1][0]*v[0] + m[1][1]*v[1] + m[1][2]*v[2],
+                    m[2][0]*v[0] + m[2][1]*v[1] + m[2][2]*v[2]);
+    }
+
+    // multiplies by the transpose, used with the inverse transform to map normals
+    vec3 apply_transposed(const vec3& v) const {
+        return vec3(m[0][0]*v[0] + m[1][0]*v[1] + m[2][0]*v[2],
+                    m[0][1]*v[0] + m[1][1]*v[1] + m[2][1]*v[2],
+                    m[0][2]*v[0] + m[1][2]*v[1] + m[2][2]*v[2]);
+    }
+
+    transform inverse() const {
+        transform x;
+        double det = m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                   - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                   + m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+        double inv_det = 1.0 / det;
+        x.m[0][0] =  (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv_det;
+        x.m[0][1] = -(m[0][1]*m[2][2] - m[0][2]*m[2][1]) * inv_det;
+        x.m[0][2] =  (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+        x.m[1][0] = -(m[1][0]*m[2][2] - m[1][2]*m[2][0]) * inv_det;
+        x.m[1][1] =  (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+        x.m[1][2] = -(m[0][0]*m[1][2] - m[0][2]*m[1][0]) * inv_det;
+        x.m[2][0] =  (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv_det;
+        x.m[2][1] = -(m[0][0]*m[2][1] - m[0][1]*m[2][0]) * inv_det;
+        x.m[2][2] =  (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+        x.t = -x.apply_vector(t);
+        return x;
+    }
+
+    // box around the transformed box (Arvo), tighter than transforming the 8 corners' box naively
+    aabb apply(const aabb& box) const {
+        point3 lo = t, hi = t;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                double a = m[i][j] * box.min()[j];
+                double b = m[i][j] * box.max()[j];
+                lo[i] += a < b ? a : b;
+                hi[i] += a < b ? b : a;
+            }
+        }
+        return aabb(lo, hi);
+    }
+};
+
+// composition, (a * b) applies b first
+inline transform operator*(const transform& a, const transform& b) {
+    transform x;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            x.m[i][j] = a.m[i][0]*b.m[0][j] + a.m[i][1]*b.m[1][j] + a.m[i][2]*b.m[2][j];
+    x.t = a.apply_point(b.t);
+    return x;
+}
+
+#endif
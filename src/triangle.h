@@ -0,0 +1,59 @@
+#ifndef TRIANGLE_H
+#define TRIANGLE_H
+
+#include "common.h"
+
+// Moller-Trumbore: solves O + t*D = v0 + u*(v1-v0) + v*(v2-v0) with Cramer's rule,
+// fills everything in rec but the material
+inline bool hit_triangle(const point3& v0, const point3& v1, const point3& v2, const ray& r, double t_min, double t_max, hit_record& rec) {
+    vec3 e1 = v1 - v0;
+    vec3 e2 = v2 - v0;
+    vec3 p = cross(r.direction(), e2);
+    auto det = dot(e1, p);
+    if (det == 0) return false; // ray parallel to the triangle
+
+    auto inv_det = 1.0 / det;
+    vec3 s = r.origin() - v0;
+    auto u = dot(s, p) * inv_det;
+    if (u < 0 || u > 1) return false;
+    vec3 q = cross(s, e1);
+    auto v = dot(r.direction(), q) * inv_det;
+    if (v < 0 || u + v > 1) return false;
+    auto t = dot(e2, q) * inv_det;
+    if (t < t_min || t > t_max) return false;
+
+    rec.t = t;
+    rec.p = r.at(t);
+    rec.set_face_normal(r, unit_vector(cross(e1, e2)));
+    return true;
+}
+
+// flat triangles have a zero thickness box, padded so slab tests never see an empty interval
+inline aabb triangle_box(const point3& v0, const point3& v1, const point3& v2) {
+    const double pad = 1e-4;
+    point3 lo(fmin(v0.x(), fmin(v1.x(), v2.x())) - pad, fmin(v0.y(), fmin(v1.y(), v2.y())) - pad, fmin(v0.z(), fmin(v1.z(), v2.z())) - pad);
+    point3 hi(fmax(v0.x(), fmax(v1.x(), v2.x())) + pad, fmax(v0.y(), fmax(v1.y(), v2.y())) + pad, fmax(v0.z(), fmax(v1.z(), v2.z())) + pad);
+    return aabb(lo, hi);
+}
+
+class triangle : public hittable {
+public:
+    point3 v0, v1, v2;
+    shared_ptr<material> mat;
+
+    triangle() = default;
+    triangle(const point3& a, const point3& b, const point3& c, shared_ptr<material> m) : v0(a), v1(b), v2(c), mat(m) {}
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        if (!hit_triangle(v0, v1, v2, r, t_min, t_max, rec)) return false;
+        rec.mat_ptr = mat.get();
+        return true;
+    }
+
+    bool bounding_box(aabb& output_box) const override {
+        output_box = triangle_box(v0, v1, v2);
+        return true;
+    }
+};
+
+#endif
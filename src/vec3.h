@@ -11,148 +11,250 @@
 
 using std::sqrt;
 
-class vec3 {
+// 3 component vector of scalar type T. The renderer uses vec3 = vec3_t<real> (see common.h),
+// other instantiations are there to convert data between precisions.
+template <typename T>
+class vec3_t {
 public:
-    double e[3];
-    vec3() : e{0,0,0} {}
-    vec3(double e0, double e1, double e2) : e{e0,e1,e2} {}
+    using scalar = T;
 
-    double x() const { return e[0]; }
-    double y() const { return e[1]; }
-    double z() const { return e[2]; }
+    T e[3];
+    vec3_t() : e{0,0,0} {}
+    vec3_t(T e0, T e1, T e2) : e{e0,e1,e2} {}
+    template <typename U>
+    explicit vec3_t(const vec3_t<U>& v) : e{T(v.e[0]), T(v.e[1]), T(v.e[2])} {}
 
-    vec3 operator-() const { return {-e[0],-e[1],-e[2]}; }
-    double operator[](int i) const { return e[i]; }
-    double& operator[](int i) { return e[i]; }
+    T x() const { return e[0]; }
+    T y() const { return e[1]; }
+    T z() const { return e[2]; }
 
-    vec3& operator+=(const vec3 &v) {
+    vec3_t operator-() const { return {-e[0],-e[1],-e[2]}; }
+    T operator[](int i) const { return e[i]; }
+    T& operator[](int i) { return e[i]; }
+
+    vec3_t& operator+=(const vec3_t &v) {
         e[0] += v.e[0];
         e[1] += v.e[1];
         e[2] += v.e[2];
         return *this;
     }
 
-    vec3& operator*=(double t) {
+    vec3_t& operator*=(T t) {
         e[0] *= t;
         e[1] *= t;
         e[2] *= t;
         return *this;
     }
 
-    vec3& operator/=(double t) {
+    vec3_t& operator/=(T t) {
         return *this *= 1/t;
     }
 
-    double length() const {
+    T length() const {
         return sqrt(length_squared());
     }
 
-    double length_squared() const {
+    T length_squared() const {
         return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
     }
 
     bool near_zero() {
-        const auto s = 1e-8;
+        const T s = 1e-8;
         return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
     }
 
-    inline static vec3 random() {
-        return {random_double(), random_double(), random_double()};
+    template <typename G>
+    inline static vec3_t random(G& gen) {
+        return vec3_t(random_double(gen), random_double(gen), random_double(gen));
+    }
+
+    template <typename G>
+    inline static vec3_t random(G& gen, double min, double max) {
+        return vec3_t(random_double(gen,min,max), random_double(gen,min,max), random_double(gen,min,max));
     }
 
-    inline static vec3 random(double min, double max) {
-        return {random_double(min,max), random_double(min,max), random_double(min,max)};
+    inline static vec3_t random() {
+        return random(thread_rng());
+    }
+
+    inline static vec3_t random(double min, double max) {
+        return random(thread_rng(), min, max);
     }
 };
 
+#ifdef RAY_SIMD_VEC3
+#include "vec3_simd.h"
+#endif
+
+using vec3 = vec3_t<real>;
 using point3 = vec3;
 using color = vec3;
 
+// the SIMD versions are padded to 4 lanes
+inline const char* vec3_backend() {
+    return sizeof(vec3) == 4 * sizeof(real) ? "simd" : "scalar";
+}
+
 // vec3 Utility Functions
+// Scalars are taken as vec3_t<T>::scalar so T is deduced from the vector alone and a double
+// constant still works with a float vector.
 
 // print out each element (space delimited)
-inline std::ostream& operator<<(std::ostream &out, const vec3 &v) {
+template <typename T>
+inline std::ostream& operator<<(std::ostream &out, const vec3_t<T> &v) {
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
 // add 2 vectors
-inline vec3 operator+(const vec3 &u, const vec3 &v) {
+template <typename T>
+inline vec3_t<T> operator+(const vec3_t<T> &u, const vec3_t<T> &v) {
     return {u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]};
 }
 
 // subtract 2 vectors
-inline vec3 operator-(const vec3 &u, const vec3 &v) {
+template <typename T>
+inline vec3_t<T> operator-(const vec3_t<T> &u, const vec3_t<T> &v) {
     return {u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]};
 }
 
 // hadamard product
-inline vec3 operator*(const vec3 &u, const vec3 &v) {
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T> &u, const vec3_t<T> &v) {
     return {u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]};
 }
 
 // scalar multiply
-inline vec3 operator*(double t, const vec3 &v) {
+template <typename T>
+inline vec3_t<T> operator*(typename vec3_t<T>::scalar t, const vec3_t<T> &v) {
     return {t*v.e[0], t*v.e[1], t*v.e[2]};
 }
 
 // scalar multiply
-inline vec3 operator*(const vec3 &v, double t) {
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T> &v, typename vec3_t<T>::scalar t) {
     return t * v;
 }
 
 // scalar divide
-inline vec3 operator/(vec3 v, double t) {
+template <typename T>
+inline vec3_t<T> operator/(vec3_t<T> v, typename vec3_t<T>::scalar t) {
     return (1/t) * v;
 }
 
 // dot product
-inline double dot(const vec3 &u, const vec3 &v) {
+template <typename T>
+inline T dot(const vec3_t<T> &u, const vec3_t<T> &v) {
     return u.e[0] * v.e[0]
          + u.e[1] * v.e[1]
          + u.e[2] * v.e[2];
 }
 
 // cross product
-inline vec3 cross(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-                u.e[2] * v.e[0] - u.e[0] * v.e[2],
-                u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+template <typename T>
+inline vec3_t<T> cross(const vec3_t<T> &u, const vec3_t<T> &v) {
+    return vec3_t<T>(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+                     u.e[2] * v.e[0] - u.e[0] * v.e[2],
+                     u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
 // convert vec to unit vec
-inline vec3 unit_vector(vec3 v) {
+template <typename T>
+inline vec3_t<T> unit_vector(vec3_t<T> v) {
     return v / v.length();
 }
 
-// random vec in unit sphere
-// TODO generate one time with random radius, theta, phi
-inline vec3 random_in_unit_sphere() {
-    while (true) {
-        auto p = vec3::random(-1,1);
-        if (p.length_squared() >= 1) continue;
-        return p;
+// Closed form samplers: each maps uniform numbers in [0, 1) to a point of the target distribution
+// with no rejection loop, so a sample always takes the same count of numbers (which keeps the
+// dimensions of a low discrepancy sampler lined up, see sampler.h).
+
+// uniform on the unit sphere: z uniform in [-1, 1] (Archimedes), azimuth uniform
+inline vec3 sample_unit_sphere(double u1, double u2) {
+    real z = 1 - 2*u1;
+    real r = sqrt(fmax(real(0), 1 - z*z));
+    real sin_phi, cos_phi;
+    sincos_turns(u2, sin_phi, cos_phi);
+    return vec3(r*cos_phi, r*sin_phi, z);
+}
+
+// uniform in the unit ball: a direction and a radius whose cube is uniform
+inline vec3 sample_unit_ball(double u1, double u2, double u3) {
+    return real(cbrt(u3)) * sample_unit_sphere(u1, u2);
+}
+
+// uniform in the unit disk (z = 0) by Shirley and Chiu's concentric mapping of the square, which
+// keeps neighbouring (u1, u2) close together unlike the polar sqrt(u1), 2 pi u2 mapping
+inline vec3 sample_unit_disk(double u1, double u2) {
+    real a = 2*u1 - 1, b = 2*u2 - 1;
+    if (a == 0 && b == 0) return vec3(0, 0, 0);
+    // the angle in turns, pi/4 * b/a or pi/2 - pi/4 * a/b
+    real r;
+    double turns;
+    if (fabs(a) > fabs(b)) {
+        r = a;
+        turns = b / (8.0*a);
+    } else {
+        r = b;
+        turns = 0.25 - a / (8.0*b);
     }
+    real sin_phi, cos_phi;
+    sincos_turns(turns, sin_phi, cos_phi);
+    return vec3(r*cos_phi, r*sin_phi, 0);
 }
 
-inline vec3 random_unit_vector() {
-    return unit_vector(random_in_unit_sphere());
+// Cosine weighted on the hemisphere around unit normal n (Malley's method: lift a uniform disk
+// point onto the hemisphere). The tangents are Duff et al.'s branchless orthonormal basis.
+inline vec3 sample_cosine_hemisphere(const vec3& n, double u1, double u2) {
+    vec3 d = sample_unit_disk(u1, u2);
+    real z = sqrt(fmax(real(0), 1 - d.x()*d.x() - d.y()*d.y()));
+    real sign = copysign(real(1), n.z());
+    real a = -1 / (sign + n.z());
+    real b = n.x() * n.y() * a;
+    vec3 tangent(1 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+    vec3 bitangent(b, sign + n.y() * n.y() * a, -n.y());
+    return d.x()*tangent + d.y()*bitangent + z*n;
+}
+
+// random vec in unit sphere
+template <typename G>
+inline vec3 random_in_unit_sphere(G& gen) {
+    double u1 = random_double(gen), u2 = random_double(gen);
+    return sample_unit_ball(u1, u2, random_double(gen));
 }
 
-inline vec3 reflect(const vec3& v, const vec3& n) {
+template <typename G>
+inline vec3 random_unit_vector(G& gen) {
+    double u1 = random_double(gen);
+    return sample_unit_sphere(u1, random_double(gen));
+}
+
+template <typename G>
+inline vec3 random_cosine_direction(const vec3& n, G& gen) {
+    double u1 = random_double(gen);
+    return sample_cosine_hemisphere(n, u1, random_double(gen));
+}
+
+template <typename T>
+inline vec3_t<T> reflect(const vec3_t<T>& v, const vec3_t<T>& n) {
     return v - 2 * dot(v,n) * n;
 }
 
-inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
-    auto cos_theta = fmin(dot(-uv, n), 1.0);
-    vec3 r_out_perp =  etai_over_etat * (uv + cos_theta*n);
-    vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
+template <typename T>
+inline vec3_t<T> refract(const vec3_t<T>& uv, const vec3_t<T>& n, typename vec3_t<T>::scalar etai_over_etat) {
+    T cos_theta = fmin(dot(-uv, n), T(1));
+    vec3_t<T> r_out_perp =  etai_over_etat * (uv + cos_theta*n);
+    vec3_t<T> r_out_parallel = -sqrt(fabs(1 - r_out_perp.length_squared())) * n;
     return r_out_perp + r_out_parallel;
 }
 
-inline vec3 random_in_unit_disk() {
-    auto theta = random_double()*2*pi;
-    auto p = vec3(cos(theta), sin(theta), 0);
-    return p;
+template <typename G>
+inline vec3 random_in_unit_disk(G& gen) {
+    double u1 = random_double(gen);
+    return sample_unit_disk(u1, random_double(gen));
 }
 
+// the same with the calling thread's generator
+inline vec3 random_in_unit_sphere() { return random_in_unit_sphere(thread_rng()); }
+inline vec3 random_unit_vector() { return random_unit_vector(thread_rng()); }
+inline vec3 random_in_unit_disk() { return random_in_unit_disk(thread_rng()); }
+
 #endif
@@ -0,0 +1,164 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "camera.h"
+#include "material.h"
+#include "lbvh.h"
+#include <chrono>
+
+// One pixel's path in a wavefront render: the ray it traces next and the product of the
+// attenuations picked up on the way there.
+struct path_state {
+    ray r;
+    color throughput;
+    uint32_t pixel;
+};
+
+// per bounce depth (0 = primary rays), filled in by render_wavefront
+struct wavefront_stats {
+    std::vector<long> rays;
+    std::vector<double> trace_seconds;
+    std::vector<double> sort_seconds;
+};
+
+// Direction octant in the top 3 bits, then the Morton code of the origin within origin_box,
+// so sorting by it groups rays that start close to each other and head the same way.
+inline uint64_t ray_sort_key(const ray& r, const point3& origin_min, const vec3& inv_extent) {
+    vec3 d = r.direction();
+    uint64_t octant = uint64_t(d.x() < 0) << 2 | uint64_t(d.y() < 0) << 1 | uint64_t(d.z() < 0);
+    vec3 o = r.origin() - origin_min;
+    point3 unit(o.x() * inv_extent.x(), o.y() * inv_extent.y(), o.z() * inv_extent.z());
+    return octant << 61 | morton_code(unit) >> 2;
+}
+
+// Reorders paths by the top 32 bits of ray_sort_key (octant and a 512^3 grid over the box of
+// the origins, not the scene, whose ground sphere alone is 2000 units wide). Finer than that
+// doesn't pay for the extra sort passes. temp is scratch space kept between bounces.
+inline void sort_paths(std::vector<path_state>& paths, std::vector<path_state>& temp, threadPool* pool = nullptr) {
+    aabb origins(paths[0].r.origin(), paths[0].r.origin());
+    for (const auto& path : paths) origins = surrounding_box(origins, aabb(path.r.origin(), path.r.origin()));
+    vec3 extent = origins.max() - origins.min();
+    vec3 inv_extent(extent.x() > 0 ? 1 / extent.x() : 0, extent.y() > 0 ? 1 / extent.y() : 0, extent.z() > 0 ? 1 / extent.z() : 0);
+    std::vector<morton_prim> keys(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        keys[i].code = ray_sort_key(paths[i].r, origins.min(), inv_extent);
+        keys[i].index = static_cast<uint32_t>(i);
+    }
+    radix_sort(keys, pool, 32);
+    temp.resize(paths.size());
+    for (size_t i = 0; i < keys.size(); i++) temp[i] = paths[keys[i].index];
+    paths.swap(temp);
+}
+
+// Renders sample number `sample` of every pixel into pixels (width * height, row j at j * width)
+// one bounce at a time instead of one path at a time: every ray of a bounce is traced before any
+// of the next. Primary rays are generated in 8x8 tiles, each tile's camera numbers drawn at once
+// by camera_samples(), and traced as packets. With sort, the rays of every later bounce are sorted
+// by ray_sort_key first, so rays scattered in all directions are traced in an order where
+// neighbours visit mostly the same nodes. Colors are the same as ray_color() in render.h,
+// background(r) is what a ray leaving the scene sees.
+// Random numbers come from each path's path_key with rng_seed() and samples (independent numbers
+// when nullptr), so the pixels only depend on the seed, the sampler and the sample index, not on
+// sort or on how many threads of pool trace and shade the rays.
+inline void render_wavefront(const accelerator& world, const camera& cam, int width, int height, int sample, int max_depth, bool sort,
+                             color (*background)(const ray&), std::vector<color>& pixels, wavefront_stats* stats = nullptr,
+                             threadPool* pool = nullptr, const sampler* samples = nullptr) {
+    pixels.assign(width * height, color(0, 0, 0));
+    if (stats) {
+        stats->rays.assign(max_depth, 0);
+        stats->trace_seconds.assign(max_depth, 0);
+        stats->sort_seconds.assign(max_depth, 0);
+    }
+    const uint64_t seed = rng_seed();
+    auto key = [&](uint32_t pixel) {
+        return path_key{seed, pixel % width, pixel / width, static_cast<uint32_t>(sample), samples};
+    };
+    std::vector<path_state> paths, temp;
+    paths.reserve(width * height);
+    path_key tile_keys[packet_size];
+    camera_sample tile_samples[packet_size];
+    for (int tile_j = height-1; tile_j >= 0; tile_j -= packet_width) {
+        for (int tile_i = 0; tile_i < width; tile_i += packet_width) {
+            // the camera numbers of the whole tile at once, see camera_samples
+            size_t first = paths.size();
+            int count = 0;
+            for (int j = tile_j; j > tile_j - packet_width && j >= 0; --j) {
+                for (int i = tile_i; i < tile_i + packet_width && i < width; ++i) {
+                    uint32_t pixel = static_cast<uint32_t>(i + j*width);
+                    tile_keys[count++] = key(pixel);
+                    paths.push_back(path_state{ray(), color(1, 1, 1), pixel});
+                }
+            }
+            camera_samples(tile_keys, count, tile_samples);
+            for (int k = 0; k < count; k++) {
+                path_state& path = paths[first + k];
+                camera_sample& gen = tile_samples[k];
+                auto u = (path.pixel % width + random_double(gen))/(width-1);
+                auto v = (path.pixel / width + random_double(gen))/(height-1);
+                path.r = cam.get_ray(u, v, gen);
+            }
+        }
+    }
+
+    int chunks = pool ? pool->size() : 1;
+    std::vector<std::vector<path_state>> next(chunks);
+    std::vector<hit_record> recs;
+    std::vector<char> hits;
+    for (int depth = 0; depth < max_depth && !paths.empty(); depth++) {
+        auto start = std::chrono::steady_clock::now();
+        if (sort && depth > 0) sort_paths(paths, temp, pool);
+        auto sorted = std::chrono::steady_clock::now();
+
+        recs.resize(paths.size());
+        hits.resize(paths.size());
+        if (depth == 0) {
+            size_t packets = (paths.size() + packet_size - 1) / packet_size;
+            parallel_chunks(pool, 0, packets, chunks, [&](int, size_t first_packet, size_t end_packet) {
+                ray_packet packet;
+                bool packet_hits[packet_size];
+                for (size_t first = first_packet * packet_size; first < end_packet * packet_size && first < paths.size(); first += packet_size) {
+                    packet.count = 0;
+                    for (size_t i = first; i < paths.size() && packet.count < packet_size; i++) packet.add(paths[i].r);
+                    world.hit_packet(packet, 0.001, infinity, &recs[first], packet_hits);
+                    for (int i = 0; i < packet.count; i++) hits[first + i] = packet_hits[i];
+                }
+            });
+        } else {
+            parallel_chunks(pool, 0, paths.size(), chunks, [&](int, size_t first, size_t end) {
+                for (size_t i = first; i < end; i++) hits[i] = world.hit(paths[i].r, 0.001, infinity, recs[i]);
+            });
+        }
+        auto traced = std::chrono::steady_clock::now();
+        if (stats) {
+            stats->rays[depth] = paths.size();
+            stats->sort_seconds[depth] = std::chrono::duration<double>(sorted - start).count();
+            stats->trace_seconds[depth] = std::chrono::duration<double>(traced - sorted).count();
+        }
+
+        // every path has its own pixel, so chunks never add to the same one
+        parallel_chunks(pool, 0, paths.size(), chunks, [&](int c, size_t first, size_t end) {
+            next[c].clear();
+            for (size_t i = first; i < end; i++) {
+                const path_state& path = paths[i];
+                color attenuation;
+                if (hits[i]) {
+                    ray scattered;
+                    sample_stream gen = key(path.pixel).bounce(depth + 1);
+                    if (scatter_material(*recs[i].mat_ptr, path.r, recs[i], attenuation, scattered, gen)) {
+                        next[c].push_back(path_state{scattered, path.throughput * attenuation, path.pixel});
+                        continue;
+                    } else if (emanate_material(*recs[i].mat_ptr, attenuation)) {
+                        pixels[path.pixel] += path.throughput * attenuation;
+                        continue;
+                    }
+                }
+                pixels[path.pixel] += path.throughput * background(path.r);
+            }
+        });
+        paths.clear();
+        for (const auto& chunk : next) paths.insert(paths.end(), chunk.begin(), chunk.end());
+    }
+    // paths still bouncing after max_depth contribute black, as in ray_color()
+}
+
+#endif
@@ -0,0 +1,463 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "flat_bvh.h"
+#include "simd.h"
+#include <queue>
+
+// Child references of a wide node: interior children are plain node indices, leaves set the
+// top bit and pack the primitive offset and count, unused slots hold wide_empty_child.
+const uint32_t wide_leaf_flag = 0x80000000u;
+const uint32_t wide_empty_child = 0xFFFFFFFFu;
+
+inline uint32_t wide_leaf(int32_t offset, int count) { return wide_leaf_flag | (uint32_t(offset) << 4) | uint32_t(count); }
+inline bool wide_is_leaf(uint32_t child) { return (child & wide_leaf_flag) != 0; }
+inline int wide_leaf_offset(uint32_t child) { return int((child & ~wide_leaf_flag) >> 4); }
+inline int wide_leaf_count(uint32_t child) { return int(child & 0xF); }
+
+// N-ary node made by collapsing log2(N) levels of a binary tree. Child boxes are stored as
+// structure of arrays, bounds[min/max][axis] holds that plane for all N children so one SIMD
+// load fetches it. axis[] keeps the binary split axes in heap order (root split first), which
+// is all that's needed to visit the children front-to-back for a given ray direction.
+template <int N>
+struct alignas(64) wide_bvh_node {
+    float bounds[2][3][N];
+    uint32_t child[N];
+    uint8_t axis[N-1];
+};
+
+// Slot s is reached from the node root by the binary path given by its bits (msb first, 1 = right),
+// axis holds the binary split axes in heap order. The slot's rank in front-to-back order is the
+// same path with every step flipped where the ray travels in the negative direction of that split's axis.
+template <int N>
+inline void wide_child_order(const uint8_t axis[N-1], const flat_ray& r, int order[N]) {
+    int k = 0;
+    while ((1 << k) < N) k++;
+    for (int s = 0; s < N; s++) {
+        int heap = 0, rank = 0;
+        for (int l = 0; l < k; l++) {
+            int bit = (s >> (k-1-l)) & 1;
+            rank = rank*2 + (bit ^ r.dir_is_neg[axis[heap]]);
+            heap = 2*heap + 1 + bit;
+        }
+        order[rank] = s;
+    }
+}
+
+// scalar box test of one ray against all N children, bit i of the result is set if child i is hit
+template <int N>
+inline int intersect_children(const wide_bvh_node<N>& node, const flat_ray& r, float t_min, float t_max) {
+    int mask = 0;
+    for (int i = 0; i < N; i++) {
+        float t0 = t_min, t1 = t_max;
+        for (int a = 0; a < 3; a++) {
+            float near = (node.bounds[r.dir_is_neg[a]][a][i] - r.orig[a]) * r.inv_dir[a];
+            float far = (node.bounds[1 - r.dir_is_neg[a]][a][i] - r.orig[a]) * r.inv_dir[a] * box_t_slack;
+            t0 = near > t0 ? near : t0;
+            t1 = far < t1 ? far : t1;
+        }
+        if (t0 <= t1) mask |= 1 << i;
+    }
+    return mask;
+}
+
+#if defined(__SSE2__)
+// 4-wide slab test: each instruction works on the same plane of all four children
+template <>
+inline int intersect_children<4>(const wide_bvh_node<4>& node, const flat_ray& r, float t_min, float t_max) {
+    __m128 t0 = _mm_set1_ps(t_min);
+    __m128 t1 = _mm_set1_ps(t_max);
+    const __m128 slack = _mm_set1_ps(box_t_slack);
+    for (int a = 0; a < 3; a++) {
+        __m128 orig = _mm_set1_ps(r.orig[a]);
+        __m128 inv_dir = _mm_set1_ps(r.inv_dir[a]);
+        __m128 near = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[r.dir_is_neg[a]][a]), orig), inv_dir);
+        __m128 far = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[1 - r.dir_is_neg[a]][a]), orig), inv_dir), slack);
+        t0 = _mm_max_ps(near, t0);
+        t1 = _mm_min_ps(far, t1);
+    }
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+#endif
+
+#if defined(RAY_X86)
+// 8-wide slab test, only called after cpu_has_avx2() said yes
+RAY_TARGET_AVX2
+inline int intersect_children_avx2(const wide_bvh_node<8>& node, const flat_ray& r, float t_min, float t_max) {
+    __m256 t0 = _mm256_set1_ps(t_min);
+    __m256 t1 = _mm256_set1_ps(t_max);
+    const __m256 slack = _mm256_set1_ps(box_t_slack);
+    for (int a = 0; a < 3; a++) {
+        // (bound - orig) * inv_dir as one fused bound * inv_dir - orig * inv_dir
+        __m256 inv_dir = _mm256_set1_ps(r.inv_dir[a]);
+        __m256 orig_inv = _mm256_set1_ps(r.orig[a] * r.inv_dir[a]);
+        __m256 near = _mm256_fmsub_ps(_mm256_load_ps(node.bounds[r.dir_is_neg[a]][a]), inv_dir, orig_inv);
+        __m256 far = _mm256_mul_ps(_mm256_fmsub_ps(_mm256_load_ps(node.bounds[1 - r.dir_is_neg[a]][a]), inv_dir, orig_inv), slack);
+        t0 = _mm256_max_ps(near, t0);
+        t1 = _mm256_min_ps(far, t1);
+    }
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+#endif
+
+// node memory per treelet of reorder_treelets(), 8 bvh4 or 4 bvh8 nodes
+const size_t wide_treelet_bytes = 1024;
+
+// bvh with N children per node (N a power of two), built by collapsing the binary SAH tree of flat_bvh
+template <int N>
+class wide_bvh : public accelerator {
+public:
+    std::vector<wide_bvh_node<N>, aligned_allocator<wide_bvh_node<N>, 64>> nodes;
+    std::vector<shared_ptr<hittable>> primitives;
+    sphere_soa leaf_spheres; // see flat_bvh::leaf_spheres
+    std::vector<primitive> leaf_closed;
+    aabb box;
+
+    wide_bvh() = default;
+    wide_bvh(const hittable_list& list) : wide_bvh(flat_bvh(list)) {}
+    wide_bvh(const flat_bvh& binary, bool refittable = false) : refittable(refittable) {
+        if (binary.nodes.empty()) return;
+        binary.bounding_box(box);
+        primitives = binary.primitives;
+        leaf_spheres = binary.leaf_spheres;
+        leaf_closed = binary.leaf_closed;
+        nodes.reserve(binary.nodes.size() / (N/2) + 1);
+        if (refittable) sources.reserve(nodes.capacity() * N);
+        collapse(binary, 0);
+    }
+
+    // Copies the boxes of a refit binary tree (the one this was built from, with the same
+    // structure) into the child slots. Every slot is a binary node, so this is a parallel copy
+    // over the nodes with no collapsing. Needs the bvh built with refittable set.
+    void refit(const flat_bvh& binary, threadPool* pool = nullptr) {
+        if (nodes.empty()) return;
+        binary.bounding_box(box);
+        leaf_spheres = binary.leaf_spheres;
+        leaf_closed = binary.leaf_closed;
+        parallel_chunks(pool, 0, nodes.size(), pool ? pool->size() : 1, [&](int, size_t cs, size_t ce) {
+            for (size_t i = cs; i < ce; i++) {
+                for (int c = 0; c < N; c++) {
+                    int32_t b = sources[i*N + c];
+                    if (b < 0) continue;
+                    for (int a = 0; a < 3; a++) {
+                        nodes[i].bounds[0][a][c] = binary.nodes[b].bounds_min[a];
+                        nodes[i].bounds[1][a][c] = binary.nodes[b].bounds_max[a];
+                    }
+                }
+            }
+        });
+    }
+
+    size_t node_count() const override { return nodes.size(); }
+    size_t node_bytes() const override { return nodes.size() * sizeof(wide_bvh_node<N>); }
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        return traverse<intersect_children<N>, false>(r, t_min, t_max, &rec);
+    }
+
+    bool occluded(const ray& r, double t_min, double t_max) const override {
+        return traverse<intersect_children<N>, true>(r, t_min, t_max, nullptr);
+    }
+
+    void hit_packet(const ray_packet& packet, double t_min, double t_max, hit_record recs[], bool hits[]) const override;
+
+    bool bounding_box(aabb& output_box) const override {
+        if (nodes.empty()) return false;
+        output_box = box;
+        return true;
+    }
+
+    // Post-build pass that replaces the depth-first node order with treelets: a node's treelet is
+    // grown from its root by repeatedly taking the child most likely to be visited (largest surface
+    // area) until it holds treelet_bytes of nodes, and the children left over start new treelets.
+    // Treelets are laid out most likely first, so the hot top of the tree is a few dense pages
+    // instead of being spread through the whole array. That only saves TLB misses: a wide node
+    // already fills whole cache lines, so a ray misses the same lines in either order (see
+    // ./bench treelets). Nodes stay cache line aligned, the root stays at 0.
+    void reorder_treelets(size_t treelet_bytes = wide_treelet_bytes) {
+        if (nodes.size() < 2) return;
+        size_t per_treelet = treelet_bytes / sizeof(wide_bvh_node<N>);
+        if (per_treelet < 1) per_treelet = 1;
+
+        typedef std::pair<double, uint32_t> weighted; // (surface area, old index)
+        std::vector<uint32_t> new_index(nodes.size());
+        std::vector<uint32_t> order;
+        order.reserve(nodes.size());
+        std::vector<uint32_t> roots(1, 0);
+        while (!roots.empty()) {
+            std::priority_queue<weighted> frontier;
+            frontier.push(weighted(area(roots.back()), roots.back()));
+            roots.pop_back();
+            for (size_t taken = 0; taken < per_treelet && !frontier.empty(); taken++) {
+                uint32_t b = frontier.top().second;
+                frontier.pop();
+                new_index[b] = static_cast<uint32_t>(order.size());
+                order.push_back(b);
+                const wide_bvh_node<N>& node = nodes[b];
+                for (int i = 0; i < N; i++) {
+                    uint32_t child = node.child[i];
+                    if (child != wide_empty_child && !wide_is_leaf(child)) frontier.push(weighted(area(child), child));
+                }
+            }
+            // the child treelets follow their parent, most likely one first
+            size_t first = roots.size();
+            for (; !frontier.empty(); frontier.pop()) roots.push_back(frontier.top().second);
+            std::reverse(roots.begin() + first, roots.end());
+        }
+
+        std::vector<wide_bvh_node<N>, aligned_allocator<wide_bvh_node<N>, 64>> reordered(nodes.size());
+        std::vector<int32_t> reordered_sources(sources.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            reordered[i] = nodes[order[i]];
+            for (int c = 0; c < N; c++) {
+                uint32_t& child = reordered[i].child[c];
+                if (child != wide_empty_child && !wide_is_leaf(child)) child = new_index[child];
+                if (refittable) reordered_sources[i*N + c] = sources[order[i]*N + c];
+            }
+        }
+        nodes.swap(reordered);
+        sources.swap(reordered_sources);
+    }
+
+    // The box test kernel is a template argument so it gets inlined into the loop.
+    // Finds the closest hit into rec, or with AnyHit returns at the first occluding primitive.
+    template <int (*Intersect)(const wide_bvh_node<N>&, const flat_ray&, float, float), bool AnyHit>
+    bool traverse(const ray& r, double t_min, double t_max, hit_record* rec) const {
+        if (nodes.empty()) return false;
+
+        flat_ray fr(r);
+        bool hit_anything = false;
+        auto closest_so_far = t_max;
+
+        // each level pushes at most N-1 children and the binary tree is at most max_bvh_depth deep
+        uint32_t stack[max_bvh_depth * N];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            uint32_t current = stack[--stack_size];
+            if (wide_is_leaf(current)) {
+                if (intersect_leaf<AnyHit>(primitives, leaf_spheres, leaf_closed, wide_leaf_offset(current), wide_leaf_count(current),
+                                           r, t_min, t_max, closest_so_far, rec)) {
+                    if (AnyHit) return true;
+                    hit_anything = true;
+                }
+                continue;
+            }
+
+            const wide_bvh_node<N>& node = nodes[current];
+            int mask = Intersect(node, fr, static_cast<float>(t_min), static_cast<float>(closest_so_far));
+            if (mask == 0) continue;
+
+            // push far-to-near so the nearest child is popped first
+            int order[N];
+            child_order(node, fr, order);
+            for (int i = N-1; i >= 0; i--) {
+                if (mask & (1 << order[i])) stack[stack_size++] = node.child[order[i]];
+            }
+        }
+
+        return hit_anything;
+    }
+
+private:
+    // binary node behind each child slot (N per node, -1 for empty slots), only kept for refit()
+    bool refittable = false;
+    std::vector<int32_t> sources;
+
+    // surface area of node i's box, the union of its occupied child slots
+    double area(uint32_t i) const {
+        const wide_bvh_node<N>& node = nodes[i];
+        float lo[3], hi[3];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::numeric_limits<float>::infinity();
+            hi[a] = -std::numeric_limits<float>::infinity();
+            for (int c = 0; c < N; c++) {
+                if (node.child[c] == wide_empty_child) continue;
+                lo[a] = fmin(lo[a], node.bounds[0][a][c]);
+                hi[a] = fmax(hi[a], node.bounds[1][a][c]);
+            }
+        }
+        double dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+        return 2.0 * (dx*dy + dy*dz + dz*dx);
+    }
+
+    static int levels() {
+        int k = 0;
+        while ((1 << k) < N) k++;
+        return k;
+    }
+
+    static void child_order(const wide_bvh_node<N>& node, const flat_ray& r, int order[N]) {
+        wide_child_order<N>(node.axis, r, order);
+    }
+
+    // Places binary node b in slots [slot, slot + 2^(k-level)) of the wide node.
+    // A binary leaf reached before the last level takes the first slot and leaves the rest empty.
+    void gather(const flat_bvh& binary, int b, int level, int heap, int slot, int slots[N], uint8_t axis[N-1]) {
+        const int k = levels();
+        const flat_bvh_node& bn = binary.nodes[b];
+        if (level == k || bn.n_primitives > 0) {
+            slots[slot] = b;
+            return;
+        }
+        axis[heap] = bn.axis;
+        int half = 1 << (k - level - 1);
+        gather(binary, b + 1, level + 1, 2*heap + 1, slot, slots, axis);
+        gather(binary, bn.second_child_offset, level + 1, 2*heap + 2, slot + half, slots, axis);
+    }
+
+    // emits the wide node rooted at binary node b (and its subtree) and returns its index
+    uint32_t collapse(const flat_bvh& binary, int b) {
+        uint32_t index = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+        if (refittable) sources.resize(nodes.size() * N);
+
+        int slots[N];
+        uint8_t axis[N-1];
+        for (int i = 0; i < N; i++) slots[i] = -1;
+        for (int i = 0; i < N-1; i++) axis[i] = 0;
+        gather(binary, b, 0, 0, 0, slots, axis);
+
+        uint32_t child[N];
+        for (int i = 0; i < N; i++) {
+            if (slots[i] < 0) {
+                child[i] = wide_empty_child;
+                continue;
+            }
+            const flat_bvh_node& bn = binary.nodes[slots[i]];
+            if (bn.n_primitives > 0) child[i] = wide_leaf(bn.primitives_offset, bn.n_primitives);
+            else child[i] = collapse(binary, slots[i]);
+        }
+
+        // nodes may have been reallocated by the recursion, fill the entry in last
+        wide_bvh_node<N>& node = nodes[index];
+        for (int i = 0; i < N; i++) {
+            node.child[i] = child[i];
+            for (int a = 0; a < 3; a++) {
+                if (slots[i] < 0) {
+                    // empty box (min > max) is never hit
+                    node.bounds[0][a][i] = std::numeric_limits<float>::infinity();
+                    node.bounds[1][a][i] = -std::numeric_limits<float>::infinity();
+                } else {
+                    node.bounds[0][a][i] = binary.nodes[slots[i]].bounds_min[a];
+                    node.bounds[1][a][i] = binary.nodes[slots[i]].bounds_max[a];
+                }
+            }
+        }
+        for (int i = 0; i < N-1; i++) node.axis[i] = axis[i];
+        if (refittable) std::copy(slots, slots + N, &sources[index * N]);
+        return index;
+    }
+};
+
+// Packet traversal (Wald et al., "Interactive Rendering with Coherent Ray Tracing"): the packet walks
+// the tree once, carrying the mask of rays still interested in the subtree. A child is skipped if the
+// packet frustum misses it, otherwise the rays are tested one at a time from the first active one and
+// the child is taken as soon as one of them hits (first hit early out), so a coherent packet usually
+// pays one box test per node. Leaves get the exact mask of rays hitting their box. Packets whose
+// directions differ in sign on some axis have no frustum and are traced one ray at a time.
+template <int N>
+void wide_bvh<N>::hit_packet(const ray_packet& packet, double t_min, double t_max, hit_record recs[], bool hits[]) const {
+    packet_frustum frustum(packet);
+    if (nodes.empty() || !frustum.coherent) {
+        accelerator::hit_packet(packet, t_min, t_max, recs, hits);
+        return;
+    }
+
+    double closest[packet_size];
+    alignas(32) float box_t_max[packet_size] = {}; // closest as floats for the box tests
+    for (int i = 0; i < packet.count; i++) {
+        hits[i] = false;
+        closest[i] = t_max;
+        box_t_max[i] = static_cast<float>(t_max);
+    }
+    // farthest closest hit over the packet, the frustum test can't use anything smaller
+    float packet_t_max = static_cast<float>(t_max);
+    // every ray shares dir_is_neg, so the child order of the first one is everyone's
+    flat_ray first_ray(packet.rays[0]);
+
+    struct entry {
+        uint32_t node;
+        uint64_t rays;
+    };
+    entry stack[max_bvh_depth * N];
+    int stack_size = 0;
+    stack[stack_size++] = entry{0, packet.count == 64 ? ~uint64_t(0) : (uint64_t(1) << packet.count) - 1};
+    while (stack_size > 0) {
+        entry current = stack[--stack_size];
+        if (wide_is_leaf(current.node)) {
+            for (uint64_t m = current.rays; m; m &= m - 1) {
+                int i = __builtin_ctzll(m);
+                if (intersect_leaf<false>(primitives, leaf_spheres, leaf_closed, wide_leaf_offset(current.node), wide_leaf_count(current.node),
+                                          packet.rays[i], t_min, t_max, closest[i], &recs[i])) {
+                    hits[i] = true;
+                    box_t_max[i] = static_cast<float>(closest[i]);
+                }
+            }
+            double farthest = 0;
+            for (int i = 0; i < packet.count; i++) farthest = fmax(farthest, closest[i]);
+            packet_t_max = static_cast<float>(farthest);
+            continue;
+        }
+
+        const wide_bvh_node<N>& node = nodes[current.node];
+        int order[N];
+        wide_child_order<N>(node.axis, first_ray, order);
+        // push far-to-near so the nearest child is popped first
+        for (int k = N-1; k >= 0; k--) {
+            int c = order[k];
+            uint32_t child = node.child[c];
+            if (child == wide_empty_child) continue;
+            float bounds_min[3] = {node.bounds[0][0][c], node.bounds[0][1][c], node.bounds[0][2][c]};
+            float bounds_max[3] = {node.bounds[1][0][c], node.bounds[1][1][c], node.bounds[1][2][c]};
+            if (!frustum.may_hit(bounds_min, bounds_max, static_cast<float>(t_min), packet_t_max)) continue;
+
+            uint64_t rays = frustum.hit_mask(bounds_min, bounds_max, static_cast<float>(t_min), box_t_max, current.rays,
+                                             !wide_is_leaf(child));
+            if (rays) stack[stack_size++] = entry{child, rays};
+        }
+    }
+}
+
+// 4-wide bvh (QBVH), children tested with one SSE instruction sequence
+using bvh4 = wide_bvh<4>;
+// 8-wide bvh, children tested with AVX2 when the cpu has it
+using bvh8 = wide_bvh<8>;
+
+#if defined(RAY_X86)
+RAY_TARGET_AVX2
+inline bool bvh8_hit_avx2(const bvh8& bvh, const ray& r, double t_min, double t_max, hit_record& rec);
+RAY_TARGET_AVX2
+inline bool bvh8_occluded_avx2(const bvh8& bvh, const ray& r, double t_min, double t_max);
+#endif
+
+template <>
+inline bool bvh8::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+#if defined(RAY_X86)
+    if (cpu_has_avx2()) return bvh8_hit_avx2(*this, r, t_min, t_max, rec);
+#endif
+    return traverse<intersect_children<8>, false>(r, t_min, t_max, &rec);
+}
+
+template <>
+inline bool bvh8::occluded(const ray& r, double t_min, double t_max) const {
+#if defined(RAY_X86)
+    if (cpu_has_avx2()) return bvh8_occluded_avx2(*this, r, t_min, t_max);
+#endif
+    return traverse<intersect_children<8>, true>(r, t_min, t_max, nullptr);
+}
+
+#if defined(RAY_X86)
+// flatten pulls the traversal loop into this AVX2 function, so the 8-wide kernel inlines into it
+RAY_TARGET_AVX2 __attribute__((flatten))
+inline bool bvh8_hit_avx2(const bvh8& bvh, const ray& r, double t_min, double t_max, hit_record& rec) {
+    return bvh.traverse<intersect_children_avx2, false>(r, t_min, t_max, &rec);
+}
+
+RAY_TARGET_AVX2 __attribute__((flatten))
+inline bool bvh8_occluded_avx2(const bvh8& bvh, const ray& r, double t_min, double t_max) {
+    return bvh.traverse<intersect_children_avx2, true>(r, t_min, t_max, nullptr);
+}
+#endif
+
+#endif